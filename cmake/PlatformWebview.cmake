@@ -29,5 +29,5 @@ if (WIN32)
     option(WIL_BUILD_TESTS  "" OFF)
     FetchContent_Declare(wil GIT_REPOSITORY "https://github.com/microsoft/wil")
     FetchContent_MakeAvailable(wil)
-    target_link_libraries(${PROJECT_NAME} PRIVATE WIL::WIL comctl32.lib)
+    target_link_libraries(${PROJECT_NAME} PRIVATE WIL::WIL comctl32.lib psapi.lib)
 endif()
\ No newline at end of file
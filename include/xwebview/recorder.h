@@ -0,0 +1,55 @@
+// Copyright 2023 xWebview
+// Author: Marc Ortuño
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace xwebview {
+  enum class RecordKind : std::uint8_t {
+    Message = 0,
+    ExecuteScript = 1,
+    Navigate = 2,
+    SetHtml = 3,
+    MessagePackMessage = 4,
+    CborMessage = 5,
+  };
+
+  struct RecordEntry {
+    std::chrono::nanoseconds timestamp;  // Since the recording started
+    RecordKind kind;
+    std::string payload;
+  };
+
+  struct ReplayReport {
+    std::size_t messages = 0;
+    std::chrono::nanoseconds elapsed{0};
+    double throughput = 0;  // Messages per second
+    std::chrono::nanoseconds meanLatency{0};
+    std::chrono::nanoseconds p99Latency{0};
+    std::chrono::nanoseconds maxLatency{0};
+  };
+
+  // Append-only log of the bridge traffic. Entries are queued by the caller and written to a
+  // memory-mapped file by a background thread, so recording does not block the UI thread.
+  class Recorder {
+    struct Impl;
+
+  public:
+    Recorder(const std::string& path);
+    ~Recorder();
+
+    void record(RecordKind kind, const std::string& payload);
+    // Empty while recording works; otherwise why the writer stopped
+    std::string error() const;
+
+    static std::vector<RecordEntry> load(const std::string& path);
+
+  private:
+    std::unique_ptr<Impl> pImpl_{nullptr};
+  };
+}  // namespace xwebview
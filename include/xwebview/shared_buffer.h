@@ -0,0 +1,36 @@
+// Copyright 2023 xWebview
+// Author: Marc Ortuño
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace xwebview {
+  using OnBufferChanged = std::function<void(std::size_t offset, std::size_t length)>;
+
+  // Memory region mapped both in the host and, as an ArrayBuffer, in the page. Created through
+  // Webview::createSharedBuffer; the page loses access once the buffer is destroyed.
+  class SharedBuffer {
+    struct Impl;
+    friend class Webview;
+
+  public:
+    ~SharedBuffer();
+
+    std::uint32_t id() const;
+    std::uint8_t* data();
+    const std::uint8_t* data() const;
+    std::size_t size() const;
+
+    // Called when the page reports a change through window.webview.notifyBufferChanged
+    OnBufferChanged onChanged;
+
+  private:
+    SharedBuffer(std::uint32_t id, std::unique_ptr<Impl> impl);
+
+    std::uint32_t id_;
+    std::unique_ptr<Impl> pImpl_{nullptr};
+  };
+}  // namespace xwebview
@@ -4,8 +4,11 @@
 #pragma once
 
 #include <utility>
+#include <chrono>
 #include <codecvt>
+#include <cstdint>
 #include <functional>
+#include <locale>
 #include <string>
 
 namespace xwebview {
@@ -28,4 +31,46 @@ namespace xwebview {
   }
 
   using MessageCallback = std::function<void(std::string)>;
+  // Receives the message still encoded with the active codec
+  using BinaryMessageCallback = std::function<void(const std::uint8_t*, std::size_t)>;
+
+  enum class MessageCodec { Json, MessagePack, Cbor };
+
+  // What to do with a view left untouched, or hidden, for timeout; a zero timeout disables the
+  // policy
+  struct IdlePolicy {
+    std::chrono::seconds timeout{0};
+    bool hiddenOnly = true;
+    bool suspend = true;
+    bool lowMemoryTarget = true;
+    bool clearCache = false;
+  };
+
+  struct MemoryUsage {
+    std::size_t jsHeapUsed = 0;   // Last value reported by the page, kept while suspended
+    std::size_t jsHeapTotal = 0;
+    std::size_t browserWorkingSet = 0;   // Bytes, read from the process even while suspended
+    std::size_t rendererWorkingSet = 0;  // Sum over the renderers of the environment
+    bool suspended = false;
+    bool lowMemoryTarget = false;
+  };
+  using MemoryUsageCallback = std::function<void(MemoryUsage)>;
+
+  struct PrefetchStats {
+    std::size_t prefetches = 0;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+  };
+
+  enum class TimelineSource { Host, Page };
+
+  struct TimelineEntry {
+    TimelineSource source;
+    std::string type;  // PerformanceEntry.entryType, or the Webview call on the host
+    std::string name;
+    double startTime;  // Milliseconds since the Unix epoch
+    double duration;   // Milliseconds
+    double value;      // Layout shift score, zero otherwise
+  };
 }  // namespace xwebview
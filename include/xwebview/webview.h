@@ -5,14 +5,18 @@
 
 #include <xwebview/window.h>
 #include <xwebview/types.h>
+#include <xwebview/recorder.h>
+#include <xwebview/shared_buffer.h>
 
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 namespace xwebview {
 
   class Webview : public Window {
     struct Impl;
+    struct View;
 
   public:
     Webview(void* hWnd = nullptr);
@@ -32,15 +36,52 @@ namespace xwebview {
     void navigate(const std::string& url);
     const std::string& getUrl();
     void setHtml(const std::string& html);
+    // Applies the difference with the previous patchHtml document in place, computed off the UI
+    // thread; reloads when the patch is larger than threshold times the new document
+    void patchHtml(const std::string& html);
+    void setPatchThreshold(double threshold);
     void onSourceChanged(const std::string& url);
     void onContentLoaded(bool success);
+    // Loads url in a hidden view so a later navigate(url) only swaps views
+    void prefetch(const std::string& url);
+    void setPrefetchLimit(std::size_t limit);
+    PrefetchStats getPrefetchStats();
 
     // functionality
     void injectScript(const std::string& script);
     void executeScript(const std::string& script);
     void addCallback(const std::string& name, MessageCallback callback);
+    void addBinaryCallback(const std::string& name, BinaryMessageCallback callback);
     void removeCallback(const std::string& name);
+    void setCodec(MessageCodec codec);
     void onMessage(const std::string& message);
+    void onBinaryMessage(const std::string& message);
+
+    // Memory
+    void setIdlePolicy(const IdlePolicy& policy);
+    void queryMemoryUsage(MemoryUsageCallback callback);
+
+    // Performance timeline
+    void enablePerformanceTimeline(std::size_t capacity = 4096);
+    // Stops collecting; the entries captured so far can still be read
+    void disablePerformanceTimeline();
+    std::vector<TimelineEntry> getTimeline(double since = 0);
+    void clearTimeline();
+
+    // Shared memory. Throws on failure when called from the UI thread; from any other thread a
+    // failure returns nullptr, since the call is marshalled and cannot propagate exceptions.
+    std::shared_ptr<SharedBuffer> createSharedBuffer(std::size_t size);
+    void notifyBufferChanged(const SharedBuffer& buffer, std::size_t offset, std::size_t length);
+
+    // Recording. startRecording throws when the file cannot be created on the UI thread; from any
+    // other thread the failure is reported by getRecordingError instead.
+    void startRecording(const std::string& path);
+    void stopRecording();
+    std::string getRecordingError();
+    // Drives the recorded messages through the registered callbacks on the calling thread, either
+    // at the recorded pace or as fast as possible. Real-time replay sleeps between messages, so
+    // run it off the UI thread or it stalls the message loop for the length of the recording.
+    ReplayReport replay(const std::string& path, bool realTime = true);
 
     //// Interoperability
     //void addCallback();
@@ -51,8 +92,28 @@ namespace xwebview {
 
   private:
     void resizeWebview(const ViewSize& size);
+    void attachHandlers(const View& view);
+    bool swapToPrefetched(const std::string& url);
+    void evictPrefetched();
+    void dispatchMessage(const std::string& message, bool replaying);
+    void dispatchBinaryMessage(const std::string& message, MessageCodec codec);
+    void bindCallback(const std::string& name);
+    void applyScript(const std::string& script);
+    void applyState();
+    void postSharedBuffer(const SharedBuffer& buffer);
+    bool loadHtml(const std::string& html);
+    void runPatchWorker();
+    void invalidatePatch(bool reload);
+    void checkIdle();
+    void recordTimeline(const char* type, const std::string& name, double start);
+    void wake();
 
     std::unique_ptr<Impl> pImpl_{nullptr};
     std::unordered_map<std::string, MessageCallback> callbacks_;
+    std::unordered_map<std::string, BinaryMessageCallback> binaryCallbacks_;
+    MessageCodec codec_{MessageCodec::Json};
+    std::unordered_map<std::uint32_t, std::weak_ptr<SharedBuffer>> sharedBuffers_;
+    std::uint32_t nextBufferId_{0};
+    std::unique_ptr<Recorder> recorder_{nullptr};
   };
 }  // namespace xwebview
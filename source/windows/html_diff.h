@@ -0,0 +1,410 @@
+// Copyright 2023 xWebview
+// Author: Marc Ortuño
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace xwebview {
+  // Minimal HTML tree, just enough to diff two versions of a generated document. Text nodes have
+  // an empty tag; comments and doctypes are dropped.
+  struct HtmlNode {
+    std::string tag;
+    std::vector<std::pair<std::string, std::string>> attributes;
+    std::string text;
+    std::vector<HtmlNode> children;
+
+    bool isText() const { return tag.empty(); }
+  };
+
+  struct HtmlPatch {
+    bool reload = false;
+    nlohmann::json ops = nlohmann::json::array();
+  };
+
+  inline std::string toLower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return value;
+  }
+
+  inline bool isBlank(const std::string& text) {
+    return std::all_of(text.begin(), text.end(),
+                       [](unsigned char c) { return std::isspace(c) != 0; });
+  }
+
+  inline bool isVoidElement(const std::string& tag) {
+    static const char* voidElements[] = {"area", "base", "br",   "col",   "embed", "hr",  "img",
+                                         "input", "link", "meta", "source", "track", "wbr"};
+    return std::any_of(std::begin(voidElements), std::end(voidElements),
+                       [&](const char* name) { return tag == name; });
+  }
+
+  inline bool isRawTextElement(const std::string& tag) {
+    return tag == "script" || tag == "style" || tag == "textarea" || tag == "title";
+  }
+
+  inline void appendText(HtmlNode& parent, const std::string& text) {
+    if (text.empty()) {
+      return;
+    }
+    if (!parent.children.empty() && parent.children.back().isText()) {
+      parent.children.back().text += text;
+    } else {
+      parent.children.push_back({"", {}, text, {}});
+    }
+  }
+
+  inline HtmlNode parseHtml(const std::string& html) {
+    HtmlNode document{"#document", {}, {}, {}};
+    std::vector<HtmlNode*> stack{&document};
+    auto lowered = toLower(html);
+    auto size = html.size();
+    std::size_t pos = 0;
+
+    auto isNameEnd = [&](std::size_t i) {
+      return i >= size || std::isspace(static_cast<unsigned char>(html[i])) || html[i] == '>'
+             || html[i] == '/' || html[i] == '=';
+    };
+    auto skipSpaces = [&] {
+      while (pos < size && std::isspace(static_cast<unsigned char>(html[pos]))) ++pos;
+    };
+
+    while (pos < size) {
+      if (html[pos] != '<') {
+        auto end = std::min(html.find('<', pos), size);
+        appendText(*stack.back(), html.substr(pos, end - pos));
+        pos = end;
+        continue;
+      }
+
+      if (html.compare(pos, 4, "<!--") == 0) {
+        auto end = html.find("-->", pos + 4);
+        pos = end == std::string::npos ? size : end + 3;
+        continue;
+      }
+
+      if (pos + 1 < size && (html[pos + 1] == '!' || html[pos + 1] == '?')) {
+        auto end = html.find('>', pos);
+        pos = end == std::string::npos ? size : end + 1;
+        continue;
+      }
+
+      if (pos + 1 < size && html[pos + 1] == '/') {
+        auto end = std::min(html.find('>', pos), size);
+        auto start = pos + 2;
+        auto nameEnd = start;
+        while (!isNameEnd(nameEnd)) ++nameEnd;
+        auto tag = lowered.substr(start, nameEnd - start);
+        for (auto i = stack.size() - 1; i > 0; --i) {
+          if (stack[i]->tag == tag) {
+            stack.resize(i);
+            break;
+          }
+        }
+        pos = end + 1;
+        continue;
+      }
+
+      if (pos + 1 >= size || !std::isalpha(static_cast<unsigned char>(html[pos + 1]))) {
+        appendText(*stack.back(), "<");
+        ++pos;
+        continue;
+      }
+
+      HtmlNode element;
+      auto nameEnd = pos + 1;
+      while (!isNameEnd(nameEnd)) ++nameEnd;
+      element.tag = lowered.substr(pos + 1, nameEnd - pos - 1);
+      pos = nameEnd;
+
+      bool selfClosing = false;
+      while (pos < size) {
+        skipSpaces();
+        if (pos >= size || html[pos] == '>') {
+          ++pos;
+          break;
+        }
+        if (html[pos] == '/') {
+          selfClosing = pos + 1 < size && html[pos + 1] == '>';
+          ++pos;
+          continue;
+        }
+
+        auto attributeEnd = pos;
+        while (!isNameEnd(attributeEnd)) ++attributeEnd;
+        if (attributeEnd == pos) {
+          ++pos;
+          continue;
+        }
+        auto name = lowered.substr(pos, attributeEnd - pos);
+        std::string value;
+        pos = attributeEnd;
+        skipSpaces();
+        if (pos < size && html[pos] == '=') {
+          ++pos;
+          skipSpaces();
+          if (pos < size && (html[pos] == '"' || html[pos] == '\'')) {
+            auto end = std::min(html.find(html[pos], pos + 1), size);
+            value = html.substr(pos + 1, end - pos - 1);
+            pos = end + 1;
+          } else {
+            auto end = pos;
+            while (end < size && !std::isspace(static_cast<unsigned char>(html[end]))
+                   && html[end] != '>') {
+              ++end;
+            }
+            value = html.substr(pos, end - pos);
+            pos = end;
+          }
+        }
+        element.attributes.emplace_back(std::move(name), std::move(value));
+      }
+      pos = std::min(pos, size);
+
+      auto& parent = *stack.back();
+      parent.children.push_back(std::move(element));
+      auto& node = parent.children.back();
+      if (isRawTextElement(node.tag) && !selfClosing) {
+        auto end = std::min(lowered.find("</" + node.tag, pos), size);
+        appendText(node, html.substr(pos, end - pos));
+        pos = html.find('>', end);
+        pos = pos == std::string::npos ? size : pos + 1;
+      } else if (!selfClosing && !isVoidElement(node.tag)) {
+        stack.push_back(&node);
+      }
+    }
+
+    return document;
+  }
+
+  inline void serializeHtml(const HtmlNode& node, std::string& out) {
+    if (node.isText()) {
+      out += node.text;
+      return;
+    }
+
+    out += '<' + node.tag;
+    for (const auto& [name, value] : node.attributes) {
+      out += ' ' + name + "=\"";
+      for (auto c : value) {
+        out += c == '"' ? std::string("&quot;") : std::string(1, c);
+      }
+      out += '"';
+    }
+    out += '>';
+    if (isVoidElement(node.tag)) {
+      return;
+    }
+    for (const auto& child : node.children) {
+      serializeHtml(child, out);
+    }
+    out += "</" + node.tag + '>';
+  }
+
+  inline std::string outerHtml(const HtmlNode& node) {
+    std::string out;
+    serializeHtml(node, out);
+    return out;
+  }
+
+  inline std::string innerHtml(const HtmlNode& node) {
+    std::string out;
+    for (const auto& child : node.children) {
+      serializeHtml(child, out);
+    }
+    return out;
+  }
+
+  // Code points that cannot be encoded, such as surrogates, become U+FFFD
+  inline void appendUtf8(std::string& out, unsigned long code) {
+    if (code == 0 || (code >= 0xd800 && code <= 0xdfff) || code > 0x10ffff) {
+      code = 0xfffd;
+    }
+    if (code < 0x80) {
+      out += static_cast<char>(code);
+    } else if (code < 0x800) {
+      out += static_cast<char>(0xc0 | (code >> 6));
+      out += static_cast<char>(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+      out += static_cast<char>(0xe0 | (code >> 12));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      out += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+      out += static_cast<char>(0xf0 | (code >> 18));
+      out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+  }
+
+  // Attribute values are kept as written; setAttribute needs them decoded
+  inline std::string decodeEntities(const std::string& value) {
+    static const std::pair<const char*, const char*> named[]
+        = {{"amp", "&"}, {"lt", "<"}, {"gt", ">"}, {"quot", "\""}, {"apos", "'"}, {"nbsp", "\xc2\xa0"}};
+
+    std::string out;
+    std::size_t pos = 0;
+    while (pos < value.size()) {
+      auto semicolon = value.find(';', pos);
+      if (value[pos] != '&' || semicolon == std::string::npos) {
+        out += value[pos++];
+        continue;
+      }
+
+      auto entity = value.substr(pos + 1, semicolon - pos - 1);
+      auto match = std::find_if(std::begin(named), std::end(named),
+                                [&](const auto& pair) { return entity == pair.first; });
+      if (match != std::end(named)) {
+        out += match->second;
+      } else if (entity.size() > 2 && entity.size() < 9 && entity[0] == '#'
+                 && (entity[1] == 'x' || entity[1] == 'X')
+                 && entity.find_first_not_of("0123456789abcdefABCDEF", 2) == std::string::npos) {
+        appendUtf8(out, std::stoul(entity.substr(2), nullptr, 16));
+      } else if (entity.size() > 1 && entity.size() < 9 && entity[0] == '#'
+                 && entity.find_first_not_of("0123456789", 1) == std::string::npos) {
+        appendUtf8(out, std::stoul(entity.substr(1)));
+      } else {
+        out += value[pos++];
+        continue;
+      }
+      pos = semicolon + 1;
+    }
+    return out;
+  }
+
+  inline const HtmlNode* findElement(const HtmlNode& node, const std::string& tag) {
+    for (const auto& child : node.children) {
+      if (child.tag == tag) {
+        return &child;
+      }
+      if (auto found = findElement(child, tag)) {
+        return found;
+      }
+    }
+    return nullptr;
+  }
+
+  inline std::vector<const HtmlNode*> significantChildren(const HtmlNode& node) {
+    std::vector<const HtmlNode*> children;
+    for (const auto& child : node.children) {
+      if (!child.isText() || !isBlank(child.text)) {
+        children.push_back(&child);
+      }
+    }
+    return children;
+  }
+
+  // Ops address elements by their index among element children, starting at document.body, and
+  // carry the expected tag so the page can detect a tree that no longer matches.
+  inline void diffNodes(const HtmlNode& previous, const HtmlNode& next, std::vector<int>& path,
+                        nlohmann::json& ops) {
+    auto op = [&](const char* name) {
+      return nlohmann::json{{"op", name}, {"path", path}, {"tag", previous.tag}};
+    };
+
+    if (previous.tag != next.tag) {
+      auto replace = op("replace");
+      replace["html"] = outerHtml(next);
+      ops.push_back(std::move(replace));
+      return;
+    }
+
+    for (const auto& [name, value] : next.attributes) {
+      auto found = std::find_if(previous.attributes.begin(), previous.attributes.end(),
+                                [&](const auto& attribute) { return attribute.first == name; });
+      if (found == previous.attributes.end() || found->second != value) {
+        auto attribute = op("attr");
+        attribute["name"] = name;
+        attribute["value"] = decodeEntities(value);
+        ops.push_back(std::move(attribute));
+      }
+    }
+    for (const auto& [name, value] : previous.attributes) {
+      auto found = std::find_if(next.attributes.begin(), next.attributes.end(),
+                                [&](const auto& attribute) { return attribute.first == name; });
+      if (found == next.attributes.end()) {
+        auto attribute = op("removeAttr");
+        attribute["name"] = name;
+        ops.push_back(std::move(attribute));
+      }
+    }
+
+    auto previousChildren = significantChildren(previous);
+    auto nextChildren = significantChildren(next);
+    auto hasText = [](const std::vector<const HtmlNode*>& children) {
+      return std::any_of(children.begin(), children.end(),
+                         [](const HtmlNode* child) { return child->isText(); });
+    };
+
+    // Mixed content is only walked when the text is unchanged; otherwise the element is rewritten
+    if (hasText(previousChildren) || hasText(nextChildren)) {
+      bool sameShape = previousChildren.size() == nextChildren.size();
+      for (std::size_t i = 0; sameShape && i < previousChildren.size(); ++i) {
+        auto a = previousChildren[i], b = nextChildren[i];
+        sameShape = a->isText() == b->isText() && (!a->isText() || a->text == b->text);
+      }
+      if (!sameShape) {
+        auto html = op("html");
+        html["html"] = innerHtml(next);
+        ops.push_back(std::move(html));
+        return;
+      }
+    }
+
+    std::vector<const HtmlNode*> previousElements, nextElements;
+    std::copy_if(previousChildren.begin(), previousChildren.end(),
+                 std::back_inserter(previousElements),
+                 [](const HtmlNode* child) { return !child->isText(); });
+    std::copy_if(nextChildren.begin(), nextChildren.end(), std::back_inserter(nextElements),
+                 [](const HtmlNode* child) { return !child->isText(); });
+
+    auto common = std::min(previousElements.size(), nextElements.size());
+    for (std::size_t i = 0; i < common; ++i) {
+      path.push_back(static_cast<int>(i));
+      diffNodes(*previousElements[i], *nextElements[i], path, ops);
+      path.pop_back();
+    }
+
+    if (nextElements.size() > common) {
+      auto append = op("append");
+      std::string html;
+      for (auto i = common; i < nextElements.size(); ++i) {
+        serializeHtml(*nextElements[i], html);
+      }
+      append["html"] = std::move(html);
+      ops.push_back(std::move(append));
+    } else if (previousElements.size() > common) {
+      auto truncate = op("truncate");
+      truncate["count"] = common;
+      ops.push_back(std::move(truncate));
+    }
+  }
+
+  // Falls back to a reload when the head changed, no body is found, or the patch grows past
+  // threshold times the size of the new document.
+  inline HtmlPatch diffHtml(const HtmlNode& previous, const HtmlNode& next, std::size_t htmlSize,
+                            double threshold) {
+    HtmlPatch patch;
+    auto previousHead = findElement(previous, "head"), nextHead = findElement(next, "head");
+    auto previousBody = findElement(previous, "body"), nextBody = findElement(next, "body");
+    if (!previousBody || !nextBody || !previousHead != !nextHead
+        || (previousHead && outerHtml(*previousHead) != outerHtml(*nextHead))) {
+      patch.reload = true;
+      return patch;
+    }
+
+    std::vector<int> path;
+    diffNodes(*previousBody, *nextBody, path, patch.ops);
+    // Documents are not required to be valid UTF-8
+    auto size = patch.ops.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace).size();
+    patch.reload = size > threshold * static_cast<double>(htmlSize);
+    return patch;
+  }
+}  // namespace xwebview
@@ -0,0 +1,256 @@
+// Copyright 2023 xWebview
+// Author: Marc Ortuño
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "nlohmann/json.hpp"
+#include "xwebview/types.h"
+
+namespace xwebview {
+  // Bootstrap injected in every document. Binary codecs send [name, message] encoded as
+  // MessagePack or CBOR, carried as a string with one byte per character. Bytes are mapped to
+  // U+0100-U+01FF: the string never holds a NUL, which would end it on the native side, and
+  // postMessage serializes it to JSON without escaping a single character.
+  const char BRIDGE_SCRIPT[] = R"JS(
+    (function() {
+      class Writer {
+        constructor() { this.grow(256); this.pos = 0; }
+        grow(size) {
+          const buffer = new Uint8Array(size);
+          if (this.buffer) buffer.set(this.buffer);
+          this.buffer = buffer;
+          this.view = new DataView(buffer.buffer);
+        }
+        reserve(n) {
+          let size = this.buffer.length;
+          while (this.pos + n > size) size *= 2;
+          if (size !== this.buffer.length) this.grow(size);
+        }
+        u8(v) { this.reserve(1); this.view.setUint8(this.pos, v); this.pos += 1; }
+        u16(v) { this.reserve(2); this.view.setUint16(this.pos, v); this.pos += 2; }
+        u32(v) { this.reserve(4); this.view.setUint32(this.pos, v); this.pos += 4; }
+        f32(v) { this.reserve(4); this.view.setFloat32(this.pos, v); this.pos += 4; }
+        f64(v) { this.reserve(8); this.view.setFloat64(this.pos, v); this.pos += 8; }
+        bytes(b) { this.reserve(b.length); this.buffer.set(b, this.pos); this.pos += b.length; }
+        toString() {
+          let result = '';
+          const chunk = new Uint16Array(0x8000);
+          for (let i = 0; i < this.pos; i += chunk.length) {
+            const length = Math.min(chunk.length, this.pos - i);
+            for (let j = 0; j < length; ++j) chunk[j] = this.buffer[i + j] + 0x100;
+            result += String.fromCharCode.apply(null, chunk.subarray(0, length));
+          }
+          return result;
+        }
+      }
+
+      const utf8 = new TextEncoder();
+      const isInt32 = (v) => Number.isInteger(v) && v >= -0x80000000 && v <= 0xffffffff;
+
+      const msgpack = {
+        head(w, v, fix, fixMax, codes) {
+          if (v <= fixMax) w.u8(fix | v);
+          else if (codes[0] && v < 0x100) { w.u8(codes[0]); w.u8(v); }
+          else if (v < 0x10000) { w.u8(codes[1]); w.u16(v); }
+          else { w.u8(codes[2]); w.u32(v); }
+        },
+        encode(w, v) {
+          if (v === null || v === undefined) w.u8(0xc0);
+          else if (typeof v === 'boolean') w.u8(v ? 0xc3 : 0xc2);
+          else if (typeof v === 'number') {
+            if (!isInt32(v)) { w.u8(0xcb); w.f64(v); }
+            else if (v >= 0 && v < 0x80) w.u8(v);
+            else if (v >= 0) this.head(w, v, 0, -1, [0xcc, 0xcd, 0xce]);
+            else if (v >= -32) w.u8(v & 0xff);
+            else if (v >= -0x80) { w.u8(0xd0); w.u8(v & 0xff); }
+            else if (v >= -0x8000) { w.u8(0xd1); w.u16(v & 0xffff); }
+            else { w.u8(0xd2); w.u32(v >>> 0); }
+          } else if (typeof v === 'string') {
+            const b = utf8.encode(v);
+            this.head(w, b.length, 0xa0, 31, [0xd9, 0xda, 0xdb]);
+            w.bytes(b);
+          } else if (v instanceof Float32Array) {
+            this.head(w, v.length, 0x90, 15, [0, 0xdc, 0xdd]);
+            for (const x of v) { w.u8(0xca); w.f32(x); }
+          } else if (v instanceof Float64Array) {
+            this.head(w, v.length, 0x90, 15, [0, 0xdc, 0xdd]);
+            for (const x of v) { w.u8(0xcb); w.f64(x); }
+          } else if (ArrayBuffer.isView(v) || v instanceof ArrayBuffer) {
+            const b = v instanceof ArrayBuffer ? new Uint8Array(v) : new Uint8Array(v.buffer, v.byteOffset, v.byteLength);
+            this.head(w, b.length, 0, -1, [0xc4, 0xc5, 0xc6]);
+            w.bytes(b);
+          } else if (Array.isArray(v)) {
+            this.head(w, v.length, 0x90, 15, [0, 0xdc, 0xdd]);
+            for (const x of v) this.encode(w, x);
+          } else {
+            const keys = Object.keys(v);
+            this.head(w, keys.length, 0x80, 15, [0, 0xde, 0xdf]);
+            for (const k of keys) { this.encode(w, k); this.encode(w, v[k]); }
+          }
+        }
+      };
+
+      const cbor = {
+        head(w, major, v) {
+          if (v < 24) w.u8(major << 5 | v);
+          else if (v < 0x100) { w.u8(major << 5 | 24); w.u8(v); }
+          else if (v < 0x10000) { w.u8(major << 5 | 25); w.u16(v); }
+          else { w.u8(major << 5 | 26); w.u32(v); }
+        },
+        encode(w, v) {
+          if (v === null || v === undefined) w.u8(0xf6);
+          else if (typeof v === 'boolean') w.u8(v ? 0xf5 : 0xf4);
+          else if (typeof v === 'number') {
+            if (!isInt32(v)) { w.u8(0xfb); w.f64(v); }
+            else if (v >= 0) this.head(w, 0, v);
+            else this.head(w, 1, -1 - v);
+          } else if (typeof v === 'string') {
+            const b = utf8.encode(v);
+            this.head(w, 3, b.length);
+            w.bytes(b);
+          } else if (v instanceof Float32Array) {
+            this.head(w, 4, v.length);
+            for (const x of v) { w.u8(0xfa); w.f32(x); }
+          } else if (v instanceof Float64Array) {
+            this.head(w, 4, v.length);
+            for (const x of v) { w.u8(0xfb); w.f64(x); }
+          } else if (ArrayBuffer.isView(v) || v instanceof ArrayBuffer) {
+            const b = v instanceof ArrayBuffer ? new Uint8Array(v) : new Uint8Array(v.buffer, v.byteOffset, v.byteLength);
+            this.head(w, 2, b.length);
+            w.bytes(b);
+          } else if (Array.isArray(v)) {
+            this.head(w, 4, v.length);
+            for (const x of v) this.encode(w, x);
+          } else {
+            const keys = Object.keys(v);
+            this.head(w, 5, keys.length);
+            for (const k of keys) { this.encode(w, k); this.encode(w, v[k]); }
+          }
+        }
+      };
+
+      const codecs = { msgpack: msgpack, cbor: cbor };
+
+      window.webview = {
+        codec: 'json',
+        async postMessage(message) {
+          window.chrome.webview.postMessage(message);
+        },
+        call(name, message) {
+          const codec = codecs[this.codec];
+          if (!codec) {
+            return this.postMessage({ name: name, message: message });
+          }
+          const writer = new Writer();
+          codec.encode(writer, [name, message]);
+          window.chrome.webview.postMessage(writer.toString());
+        }
+      };
+    })();
+  )JS";
+
+  inline const char* codecName(MessageCodec codec) {
+    switch (codec) {
+      case MessageCodec::MessagePack:
+        return "msgpack";
+      case MessageCodec::Cbor:
+        return "cbor";
+      default:
+        return "json";
+    }
+  }
+
+  struct MessageEnvelope {
+    std::string name;
+    const std::uint8_t* payload = nullptr;
+    std::size_t size = 0;
+  };
+
+  inline std::size_t readBigEndian(const std::uint8_t* data, std::size_t bytes) {
+    std::size_t value = 0;
+    for (std::size_t i = 0; i < bytes; ++i) {
+      value = (value << 8) | data[i];
+    }
+    return value;
+  }
+
+  // Reads the [name, message] header in place, leaving the payload undecoded
+  inline bool readEnvelope(MessageCodec codec, const std::uint8_t* data, std::size_t size,
+                           MessageEnvelope& envelope) {
+    if (size < 2) {
+      return false;
+    }
+
+    std::size_t header = 0, length = 0;
+    auto tag = data[1];
+    if (codec == MessageCodec::MessagePack) {
+      if (data[0] != 0x92) {
+        return false;
+      }
+      if ((tag & 0xe0) == 0xa0) {
+        header = 1, length = tag & 0x1f;
+      } else if (tag >= 0xd9 && tag <= 0xdb) {
+        header = 1 + (std::size_t{1} << (tag - 0xd9));
+      } else {
+        return false;
+      }
+    } else if (codec == MessageCodec::Cbor) {
+      if (data[0] != 0x82 || (tag & 0xe0) != 0x60) {
+        return false;
+      }
+      if ((tag & 0x1f) < 24) {
+        header = 1, length = tag & 0x1f;
+      } else if ((tag & 0x1f) <= 26) {
+        header = 1 + (std::size_t{1} << ((tag & 0x1f) - 24));
+      } else {
+        return false;
+      }
+    } else {
+      return false;
+    }
+
+    if (1 + header > size) {
+      return false;
+    }
+    if (header > 1) {
+      length = readBigEndian(data + 2, header - 1);
+    }
+    auto offset = 1 + header;
+    if (length > size - offset) {
+      return false;
+    }
+
+    envelope.name.assign(reinterpret_cast<const char*>(data + offset), length);
+    envelope.payload = data + offset + length;
+    envelope.size = size - offset - length;
+    return true;
+  }
+
+  // Undoes the one-byte-per-character transport of the bridge script
+  inline bool readBinaryString(std::wstring_view text, std::string& bytes) {
+    bytes.resize(text.size());
+    for (std::size_t i = 0; i < text.size(); ++i) {
+      if (text[i] < 0x100 || text[i] > 0x1ff) {
+        return false;
+      }
+      bytes[i] = static_cast<char>(text[i] - 0x100);
+    }
+    return true;
+  }
+
+  // Returns a discarded value for malformed input instead of throwing
+  inline nlohmann::json decodeMessage(MessageCodec codec, const std::uint8_t* data,
+                                      std::size_t size) {
+    if (codec == MessageCodec::MessagePack) {
+      return nlohmann::json::from_msgpack(data, data + size, true, false);
+    }
+    if (codec == MessageCodec::Cbor) {
+      return nlohmann::json::from_cbor(data, data + size, true, false);
+    }
+    return nlohmann::json::parse(data, data + size, nullptr, false);
+  }
+}  // namespace xwebview
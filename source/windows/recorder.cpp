@@ -0,0 +1,248 @@
+// Copyright 2023 xWebview
+// Author: Marc Ortuño
+
+#include <windows.h>
+
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include "xwebview/recorder.h"
+#include "xwebview/types.h"
+
+using namespace xwebview;
+
+namespace {
+  // File layout: magic, the committed length, then one record per entry as
+  // [u64 timestamp ns][u8 kind][u32 payload size][payload bytes]
+  // The committed length is updated after every batch, so a log left behind by a crash is read
+  // up to the last complete batch instead of into the zeroed tail of the mapping.
+  constexpr char RECORD_MAGIC[8] = {'X', 'W', 'V', 'R', 'E', 'C', '0', '2'};
+  constexpr std::size_t COMMITTED_OFFSET = sizeof(RECORD_MAGIC);
+  constexpr std::size_t FILE_HEADER_SIZE = COMMITTED_OFFSET + sizeof(std::uint64_t);
+  constexpr std::size_t RECORD_HEADER_SIZE
+      = sizeof(std::uint64_t) + sizeof(std::uint8_t) + sizeof(std::uint32_t);
+  constexpr std::uint64_t INITIAL_CAPACITY = 1 << 20;
+
+  void throwLastError() {
+    throw std::system_error(static_cast<int>(GetLastError()), std::system_category());
+  }
+}  // namespace
+
+struct Recorder::Impl {
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+  std::uint8_t* view = nullptr;
+  std::uint64_t capacity = 0;
+  std::uint64_t offset = 0;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<RecordEntry> pending;
+  bool stopping = false;
+  std::string error;
+  std::thread writer;
+
+  void map(std::uint64_t size);
+  void unmap();
+  void append(const void* data, std::size_t size);
+  void write(const RecordEntry& entry);
+  void commit();
+  void close();
+  void run();
+};
+
+void Recorder::Impl::map(std::uint64_t size) {
+  mapping = CreateFileMapping(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+                              static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+  if (!mapping) {
+    throwLastError();
+  }
+
+  view = static_cast<std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0));
+  if (!view) {
+    throwLastError();
+  }
+  capacity = size;
+}
+
+void Recorder::Impl::unmap() {
+  if (view) {
+    UnmapViewOfFile(view);
+    view = nullptr;
+  }
+  if (mapping) {
+    CloseHandle(mapping);
+    mapping = nullptr;
+  }
+}
+
+void Recorder::Impl::append(const void* data, std::size_t size) {
+  if (offset + size > capacity) {
+    auto grown = capacity * 2;
+    while (offset + size > grown) {
+      grown *= 2;
+    }
+    unmap();
+    map(grown);
+  }
+  std::memcpy(view + offset, data, size);
+  offset += size;
+}
+
+void Recorder::Impl::write(const RecordEntry& entry) {
+  std::uint8_t header[RECORD_HEADER_SIZE];
+  auto timestamp = static_cast<std::uint64_t>(entry.timestamp.count());
+  auto kind = static_cast<std::uint8_t>(entry.kind);
+  auto size = static_cast<std::uint32_t>(entry.payload.size());
+  std::memcpy(header, &timestamp, sizeof(timestamp));
+  std::memcpy(header + sizeof(timestamp), &kind, sizeof(kind));
+  std::memcpy(header + sizeof(timestamp) + sizeof(kind), &size, sizeof(size));
+
+  append(header, sizeof(header));
+  append(entry.payload.data(), entry.payload.size());
+}
+
+void Recorder::Impl::commit() {
+  std::memcpy(view + COMMITTED_OFFSET, &offset, sizeof(offset));
+}
+
+void Recorder::Impl::close() {
+  // Drop the unused tail of the last mapping
+  unmap();
+  if (file != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER size;
+    size.QuadPart = static_cast<LONGLONG>(offset);
+    SetFilePointerEx(file, size, nullptr, FILE_BEGIN);
+    SetEndOfFile(file);
+    CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+  }
+}
+
+void Recorder::Impl::run() {
+  std::vector<RecordEntry> batch;
+  while (true) {
+    {
+      std::unique_lock lock(mutex);
+      condition.wait(lock, [&] { return stopping || !pending.empty(); });
+      if (pending.empty()) {
+        return;
+      }
+      batch.swap(pending);
+    }
+
+    // A failure while growing the mapping ends the recording; what was committed stays readable
+    try {
+      for (const auto& entry : batch) {
+        write(entry);
+      }
+      commit();
+    } catch (const std::exception& exception) {
+      std::lock_guard lock(mutex);
+      error = exception.what();
+      stopping = true;
+      pending.clear();
+      return;
+    }
+    batch.clear();
+  }
+}
+
+Recorder::Recorder(const std::string& path) : pImpl_{std::make_unique<Impl>()} {
+  pImpl_->file = CreateFile(s2ws(path).c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (pImpl_->file == INVALID_HANDLE_VALUE) {
+    throwLastError();
+  }
+
+  try {
+    std::uint8_t header[FILE_HEADER_SIZE] = {};
+    std::memcpy(header, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    pImpl_->map(INITIAL_CAPACITY);
+    pImpl_->append(header, sizeof(header));
+    pImpl_->commit();
+  } catch (...) {
+    pImpl_->close();
+    throw;
+  }
+  pImpl_->writer = std::thread([this] { pImpl_->run(); });
+}
+
+Recorder::~Recorder() {
+  {
+    std::lock_guard lock(pImpl_->mutex);
+    pImpl_->stopping = true;
+  }
+  pImpl_->condition.notify_one();
+  if (pImpl_->writer.joinable()) {
+    pImpl_->writer.join();
+  }
+  pImpl_->close();
+}
+
+void Recorder::record(RecordKind kind, const std::string& payload) {
+  auto timestamp = std::chrono::steady_clock::now() - pImpl_->start;
+  {
+    std::lock_guard lock(pImpl_->mutex);
+    if (pImpl_->stopping) {
+      return;
+    }
+    pImpl_->pending.push_back(
+        {std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp), kind, payload});
+  }
+  pImpl_->condition.notify_one();
+}
+
+std::string Recorder::error() const {
+  std::lock_guard lock(pImpl_->mutex);
+  return pImpl_->error;
+}
+
+std::vector<RecordEntry> Recorder::load(const std::string& path) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) {
+    throw std::runtime_error("Cannot open recording " + path);
+  }
+
+  char magic[sizeof(RECORD_MAGIC)];
+  if (!stream.read(magic, sizeof(magic)) || std::memcmp(magic, RECORD_MAGIC, sizeof(magic))) {
+    throw std::runtime_error("Invalid recording " + path);
+  }
+
+  std::uint64_t committed;
+  if (!stream.read(reinterpret_cast<char*>(&committed), sizeof(committed))) {
+    throw std::runtime_error("Invalid recording " + path);
+  }
+
+  std::vector<RecordEntry> entries;
+  std::uint8_t header[RECORD_HEADER_SIZE];
+  std::uint64_t position = FILE_HEADER_SIZE;
+  while (position + sizeof(header) <= committed
+         && stream.read(reinterpret_cast<char*>(header), sizeof(header))) {
+    std::uint64_t timestamp;
+    std::uint8_t kind;
+    std::uint32_t size;
+    std::memcpy(&timestamp, header, sizeof(timestamp));
+    std::memcpy(&kind, header + sizeof(timestamp), sizeof(kind));
+    std::memcpy(&size, header + sizeof(timestamp) + sizeof(kind), sizeof(size));
+
+    position += sizeof(header) + size;
+    if (position > committed) {
+      break;
+    }
+
+    std::string payload(size, '\0');
+    if (!stream.read(payload.data(), size)) {
+      throw std::runtime_error("Truncated recording " + path);
+    }
+    entries.push_back({std::chrono::nanoseconds(timestamp), static_cast<RecordKind>(kind),
+                       std::move(payload)});
+  }
+  return entries;
+}
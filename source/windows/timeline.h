@@ -0,0 +1,96 @@
+// Copyright 2023 xWebview
+// Author: Marc Ortuño
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "xwebview/types.h"
+
+namespace xwebview {
+  // Same clock as performance.timeOrigin + entry.startTime in the page
+  inline double timelineNow() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(system_clock::now().time_since_epoch()).count();
+  }
+
+  // Fixed-size ring of the latest entries. Disabling only pauses collection; captured entries
+  // stay readable until cleared or pushed out.
+  class TimelineBuffer {
+  public:
+    // A zero capacity disables collection
+    void enable(std::size_t capacity) {
+      std::lock_guard lock(mutex_);
+      enabled_ = capacity > 0;
+      if (!enabled_ || capacity == capacity_) {
+        return;
+      }
+
+      // Unroll the ring oldest first and keep the newest entries that fit
+      if (entries_.size() == capacity_) {
+        std::rotate(entries_.begin(), entries_.begin() + static_cast<std::ptrdiff_t>(next_),
+                    entries_.end());
+      }
+      if (entries_.size() > capacity) {
+        entries_.erase(entries_.begin(),
+                       entries_.end() - static_cast<std::ptrdiff_t>(capacity));
+      }
+      entries_.shrink_to_fit();
+      entries_.reserve(capacity);
+      capacity_ = capacity;
+      next_ = entries_.size() % capacity_;
+    }
+
+    void disable() {
+      std::lock_guard lock(mutex_);
+      enabled_ = false;
+    }
+
+    bool enabled() {
+      std::lock_guard lock(mutex_);
+      return enabled_;
+    }
+
+    void push(TimelineEntry entry) {
+      std::lock_guard lock(mutex_);
+      if (!enabled_) {
+        return;
+      }
+      if (entries_.size() < capacity_) {
+        entries_.push_back(std::move(entry));
+      } else {
+        entries_[next_] = std::move(entry);
+      }
+      next_ = (next_ + 1) % capacity_;
+    }
+
+    std::vector<TimelineEntry> snapshot(double since) {
+      std::vector<TimelineEntry> result;
+      {
+        std::lock_guard lock(mutex_);
+        std::copy_if(entries_.begin(), entries_.end(), std::back_inserter(result),
+                     [&](const TimelineEntry& entry) { return entry.startTime >= since; });
+      }
+      std::stable_sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+        return a.startTime < b.startTime;
+      });
+      return result;
+    }
+
+    void clear() {
+      std::lock_guard lock(mutex_);
+      entries_.clear();
+      next_ = 0;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::vector<TimelineEntry> entries_;
+    std::size_t capacity_ = 0;
+    std::size_t next_ = 0;
+    bool enabled_ = false;
+  };
+}  // namespace xwebview
@@ -1,6 +1,11 @@
 // Copyright 2023 xWebview
 // Author: Marc Ortuño
 
+#include <algorithm>
+#include <string_view>
+#include <thread>
+
+#include "message_codec.h"
 #include "nlohmann/json.hpp"
 #include "webview_impl.h"
 #include "window_impl.h"
@@ -13,9 +18,79 @@ Webview::Webview(void* hWnd) : Window{hWnd}, pImpl_(std::make_unique<Impl>()) {
     throw std::exception("Cannot initialize webview");
   }
 
-  pImpl_->webview_->add_WebMessageReceived(
+  attachHandlers(View{pImpl_->webviewController_, pImpl_->webview_});
+
+  injectScript(BRIDGE_SCRIPT);
+  injectScript(R"(
+                window.webview.sharedBuffers = {};
+                window.webview.notifyBufferChanged = function(id, offset, length) {
+                    // Keys of sharedBuffers are strings
+                    window.webview.postMessage({ sharedBuffer: Number(id), offset: offset, length: length });
+                };
+                window.chrome.webview.addEventListener('sharedbufferreceived', (event) => {
+                    const id = event.additionalData.sharedBuffer;
+                    window.webview.sharedBuffers[id] = event.getBuffer();
+                    window.dispatchEvent(new CustomEvent('sharedbuffer', { detail: { id: id } }));
+                });
+                window.webview.applyPatch = function(ops) {
+                    const nodes = ops.map((op) => {
+                        let node = document.body;
+                        for (const index of op.path) {
+                            node = node && node.children[index];
+                        }
+                        return node && node.tagName.toLowerCase() === op.tag ? node : null;
+                    });
+                    if (nodes.some((node) => !node)) {
+                        window.webview.postMessage({ patchFailed: true });
+                        return;
+                    }
+                    ops.forEach((op, i) => {
+                        const node = nodes[i];
+                        switch (op.op) {
+                            case 'replace': node.outerHTML = op.html; break;
+                            case 'html': node.innerHTML = op.html; break;
+                            case 'attr': node.setAttribute(op.name, op.value); break;
+                            case 'removeAttr': node.removeAttribute(op.name); break;
+                            case 'append': node.insertAdjacentHTML('beforeend', op.html); break;
+                            case 'truncate':
+                                while (node.children.length > op.count) node.lastElementChild.remove();
+                                break;
+                        }
+                    });
+                };
+                window.chrome.webview.addEventListener('message', (event) => {
+                    if (event.data && event.data.sharedBuffer !== undefined) {
+                        window.dispatchEvent(new CustomEvent('sharedbufferchanged', { detail: event.data }));
+                    }
+                });
+                )");
+
+  onWindowResize = [=](ViewSize size) { resizeWebview(size); };
+
+  onShowWindow = [=](bool state) { showWebview(state); };
+}
+
+// Handlers are shared by the active view and the prefetched ones; events only reach the owner
+// while the sender is the visible view
+void Webview::attachHandlers(const View& view) {
+  view.webview_->add_WebMessageReceived(
       Callback<ICoreWebView2WebMessageReceivedEventHandler>(
           [=](ICoreWebView2* sender, ICoreWebView2WebMessageReceivedEventArgs* args) {
+            if (sender != pImpl_->webview_.get()) {
+              return S_OK;
+            }
+
+            // Binary codecs post strings with one byte per character
+            wil::unique_cotaskmem_string binaryString;
+            if (codec_ != MessageCodec::Json
+                && SUCCEEDED(args->TryGetWebMessageAsString(&binaryString))) {
+              std::string message;
+              if (readBinaryString(binaryString.get(), message)) {
+                onBinaryMessage(message);
+              }
+              return S_OK;
+            }
+
             wil::unique_cotaskmem_string jsonString;
             args->get_WebMessageAsJson(&jsonString);
             onMessage(ws2s(jsonString.get()).c_str());
@@ -24,12 +99,55 @@ Webview::Webview(void* hWnd) : Window{hWnd}, pImpl_(std::make_unique<Impl>()) {
           .Get(),
       nullptr);
 
-  pImpl_->webview_->add_NavigationCompleted(
+  view.webview_->add_NavigationStarting(
+      Callback<ICoreWebView2NavigationStartingEventHandler>(
+          [=](ICoreWebView2* sender, ICoreWebView2NavigationStartingEventArgs* args) -> HRESULT {
+            if (sender == pImpl_->webview_.get() && pImpl_->patchReloadStarting_) {
+              UINT64 navigationId;
+              args->get_NavigationId(&navigationId);
+              pImpl_->patchReloadId_ = navigationId;
+              pImpl_->patchReloadStarting_ = false;
+            }
+            return S_OK;
+          })
+          .Get(),
+      nullptr);
+
+  view.webview_->add_NavigationCompleted(
       Callback<ICoreWebView2NavigationCompletedEventHandler>(
           [=](ICoreWebView2* sender, ICoreWebView2NavigationCompletedEventArgs* args) -> HRESULT {
             BOOL success;
             args->get_IsSuccess(&success);
+            if (sender != pImpl_->webview_.get()) {
+              auto parked = std::find_if(
+                  pImpl_->prefetched_.begin(), pImpl_->prefetched_.end(),
+                  [&](const View& candidate) { return candidate.webview_.get() == sender; });
+              if (parked != pImpl_->prefetched_.end()) {
+                parked->loaded_ = static_cast<bool>(success);
+              }
+              return S_OK;
+            }
+
+            UINT64 navigationId;
+            args->get_NavigationId(&navigationId);
+            if (pImpl_->patchReloadId_ == navigationId) {
+              // Held patches now apply to the reloaded document, or reload again if it failed
+              pImpl_->patchReloadId_.reset();
+              {
+                std::lock_guard lock(pImpl_->patchMutex_);
+                pImpl_->patchLoading_ = false;
+                pImpl_->patchBaseline_ = pImpl_->patchBaseline_ && success;
+              }
+              pImpl_->patchCondition_.notify_one();
+            }
+
             if (success) {
+              // A new document starts without the buffers handed to the previous one
+              for (const auto& [id, weak] : sharedBuffers_) {
+                if (auto buffer = weak.lock()) {
+                  postSharedBuffer(*buffer);
+                }
+              }
               onContentLoaded(success);
             }
             return S_OK;
@@ -37,31 +155,43 @@ Webview::Webview(void* hWnd) : Window{hWnd}, pImpl_(std::make_unique<Impl>()) {
           .Get(),
       nullptr);
 
-  pImpl_->webview_->add_SourceChanged(
+  view.webview_->add_SourceChanged(
       Callback<ICoreWebView2SourceChangedEventHandler>(
           [=](ICoreWebView2* sender, ICoreWebView2SourceChangedEventArgs* args) -> HRESULT {
+            if (sender != pImpl_->webview_.get()) {
+              return S_OK;
+            }
+
             wil::unique_cotaskmem_string url;
             onSourceChanged(getUrl());
             return S_OK;
           })
           .Get(),
       nullptr);
+}
 
-  injectScript(R"(
-                window.webview = {
-                    async postMessage(message) 
-                    {
-                        window.chrome.webview.postMessage(message);
-                    }
-                };
-                )");
-
-  onWindowResize = [=](ViewSize size) { resizeWebview(size); };
+Webview::~Webview() {
+  *pImpl_->alive_ = false;
+  for (auto& view : pImpl_->prefetched_) {
+    if (view.controller_) {
+      view.controller_->Close();
+    }
+  }
 
-  onShowWindow = [=](bool state) { showWebview(state); };
-}
+  if (pImpl_->idleTimer_) {
+    KillTimer(nullptr, pImpl_->idleTimer_);
+    Impl::idleTimers_.erase(pImpl_->idleTimer_);
+  }
 
-Webview::~Webview(){};
+  {
+    std::lock_guard lock(pImpl_->patchMutex_);
+    pImpl_->patchStopping_ = true;
+  }
+  pImpl_->patchCondition_.notify_one();
+  if (pImpl_->patchWorker_.joinable()) {
+    pImpl_->patchWorker_.join();
+  }
+};
 
 void Webview::enableDevTools(bool state) {
   if (!Window::pImpl_->isThreadSafe()) {
@@ -122,6 +252,12 @@ void Webview::setWebviewPosition(const ViewRect& rect) {
 
 void Webview::showWebview(bool state) {
   if (pImpl_->webviewController_) {
+    if (state) {
+      wake();
+    } else {
+      // The idle timeout counts from the moment the view was hidden
+      pImpl_->lastActivity_ = std::chrono::steady_clock::now();
+    }
     pImpl_->webviewController_->put_IsVisible(static_cast<BOOL>(state));
   }
 }
@@ -131,7 +267,15 @@ void Webview::navigate(const std::string& url) {
     return Window::pImpl_->postMessageSafe([=] { navigate(url); });
   }
 
-  pImpl_->webview_->Navigate(s2ws(url).c_str());
+  wake();
+  recordTimeline("navigate", url, timelineNow());
+  if (recorder_) {
+    recorder_->record(RecordKind::Navigate, url);
+  }
+  if (!swapToPrefetched(url)) {
+    pImpl_->webview_->Navigate(s2ws(url).c_str());
+  }
+  invalidatePatch(false);
 }
 
 const std::string& xwebview::Webview::getUrl() {
@@ -149,7 +293,17 @@ void Webview::setHtml(const std::string& html) {
     return Window::pImpl_->postMessageSafe([=] { setHtml(html); });
   }
 
-  pImpl_->webview_->NavigateToString(s2ws(html).c_str());
+  invalidatePatch(false);
+  loadHtml(html);
+}
+
+bool Webview::loadHtml(const std::string& html) {
+  wake();
+  recordTimeline("setHtml", "", timelineNow());
+  if (recorder_) {
+    recorder_->record(RecordKind::SetHtml, html);
+  }
+  return SUCCEEDED(pImpl_->webview_->NavigateToString(s2ws(html).c_str()));
 }
 
 void Webview::onSourceChanged(const std::string& url) {}
@@ -161,48 +315,848 @@ void Webview::injectScript(const std::string& script) {
     return Window::pImpl_->postMessageSafe([=] { injectScript(script); });
   }
 
-  pImpl_->webview_->AddScriptToExecuteOnDocumentCreated(s2ws(script).c_str(), nullptr);
+  wake();
+  pImpl_->injectedScripts_.push_back(s2ws(script));
+  pImpl_->webview_->AddScriptToExecuteOnDocumentCreated(pImpl_->injectedScripts_.back().c_str(),
+                                                        nullptr);
+  // Views still being created receive injectedScripts_ once ready
+  for (const auto& view : pImpl_->prefetched_) {
+    if (view.webview_) {
+      view.webview_->AddScriptToExecuteOnDocumentCreated(
+          pImpl_->injectedScripts_.back().c_str(), nullptr);
+    }
+  }
 }
 
 void Webview::executeScript(const std::string& script) {
   if (!Window::pImpl_->isThreadSafe()) {
     return Window::pImpl_->postMessageSafe([=] { executeScript(script); });
   }
+
+  wake();
+  recordTimeline("executeScript", script.substr(0, 64), timelineNow());
+  if (recorder_) {
+    recorder_->record(RecordKind::ExecuteScript, script);
+  }
   pImpl_->webview_->ExecuteScript(s2ws(script).c_str(), nullptr);
 }
 
+// Bridge state such as callbacks and the codec must match in parked views too, including the
+// documents they already loaded
+void Webview::applyScript(const std::string& script) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { applyScript(script); });
+  }
+
+  injectScript(script);
+  executeScript(script);
+  auto wide = s2ws(script);
+  for (const auto& view : pImpl_->prefetched_) {
+    if (view.webview_) {
+      view.webview_->ExecuteScript(wide.c_str(), nullptr);
+    }
+  }
+}
+
+void Webview::applyState() {
+  auto script = std::string("window.webview.codec = '") + codecName(codec_) + "';";
+  if (pImpl_->timelineInjected_) {
+    script += std::string("window.webview.performanceTimeline = ")
+              + (pImpl_->timeline_.enabled() ? "true;" : "false;");
+  }
+  pImpl_->stateScript_ = s2ws(script);
+
+  pImpl_->injectStateScript(pImpl_->webview_);
+  executeScript(script);
+  for (const auto& view : pImpl_->prefetched_) {
+    if (view.webview_) {
+      pImpl_->injectStateScript(view.webview_);
+      view.webview_->ExecuteScript(pImpl_->stateScript_.c_str(), nullptr);
+    }
+  }
+}
+
 void Webview::addCallback(const std::string& name, MessageCallback callback) {
   callbacks_.emplace(name, callback);
+  bindCallback(name);
+}
+
+void Webview::addBinaryCallback(const std::string& name, BinaryMessageCallback callback) {
+  binaryCallbacks_.emplace(name, callback);
+  bindCallback(name);
+}
+
+void Webview::bindCallback(const std::string& name) {
   auto script = "window['" + name + "'] = function(message) { const name = '" + name + "';" +
                 R"(
-                    window.webview.postMessage({
-                              name: name,
-                              message: message,
-                            });
+                    window.webview.call(name, message);
                     }
                 )";
-  injectScript(script);
-  executeScript(script);
+  applyScript(script);
 }
 
 void Webview::removeCallback(const std::string& name) {
   callbacks_.erase(name);
+  binaryCallbacks_.erase(name);
   auto script = "delete window['" + name + "']";
-  injectScript(script);
-  executeScript(script);
+  applyScript(script);
 }
 
-void Webview::onMessage(const std::string& message) {
-  auto json = nlohmann::json::parse(message);
+void Webview::onMessage(const std::string& message) { dispatchMessage(message, false); }
+
+void Webview::dispatchMessage(const std::string& message, bool replaying) {
+  // Malformed messages are dropped; they may come from the page or from a replayed recording
+  auto json = nlohmann::json::parse(message, nullptr, false);
   if (json.is_object()) {
-    if (json.contains("name") || json.contains("message")) {
-      auto callback = callbacks_.find(json["name"]);
+    // Control messages from the bridge script describe the live page, not the recorded one. They
+    // are not activity either, so they neither wake an idle view nor get recorded.
+    auto control = json.contains("sharedBuffer") || json.contains("performance")
+                   || json.contains("patchFailed");
+    if (control && replaying) {
+      return;
+    }
+    if (!control && !replaying) {
+      wake();
+      if (recorder_) {
+        recorder_->record(RecordKind::Message, message);
+      }
+    }
+
+    if (json.contains("sharedBuffer")) {
+      auto isIndex = [&](const char* key, bool optional) {
+        return json.contains(key) ? json[key].is_number_unsigned() : optional;
+      };
+      if (!isIndex("sharedBuffer", false) || !isIndex("offset", true)
+          || !isIndex("length", true)) {
+        return;
+      }
+      auto buffer = sharedBuffers_.find(json["sharedBuffer"].get<std::uint32_t>());
+      if (buffer == sharedBuffers_.end()) {
+        return;
+      }
+      if (auto shared = buffer->second.lock(); shared && shared->onChanged) {
+        shared->onChanged(json.value("offset", std::size_t{0}),
+                          json.value("length", shared->size()));
+      }
+      return;
+    }
+
+    if (json.contains("performance")) {
+      for (const auto& entry : json["performance"]) {
+        pImpl_->timeline_.push({TimelineSource::Page, entry.value("type", ""),
+                                entry.value("name", ""), entry.value("start", 0.0),
+                                entry.value("duration", 0.0), entry.value("value", 0.0)});
+      }
+      return;
+    }
+
+    if (json.contains("patchFailed")) {
+      invalidatePatch(true);
+      return;
+    }
+
+    if ((json.contains("name") || json.contains("message")) && json["name"].is_string()) {
+      auto start = timelineNow();
+      auto name = json["name"].get<std::string>();
+      auto payload = json["message"].dump();
+      if (auto binary = binaryCallbacks_.find(name); binary != binaryCallbacks_.end()) {
+        binary->second(reinterpret_cast<const std::uint8_t*>(payload.data()), payload.size());
+        recordTimeline("message", name, start);
+        return;
+      }
+
+      auto callback = callbacks_.find(name);
       if (callback == callbacks_.end()) {
         // No callbacks defined
         return;
       }
 
-      callback->second(json["message"].dump());
+      callback->second(payload);
+      recordTimeline("message", name, start);
+    }
+  }
+}
+
+void Webview::setCodec(MessageCodec codec) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { setCodec(codec); });
+  }
+
+  codec_ = codec;
+  applyState();
+}
+
+void Webview::onBinaryMessage(const std::string& message) {
+  wake();
+  if (recorder_) {
+    // The codec is part of the kind so a recording replays the same way under any active codec
+    recorder_->record(codec_ == MessageCodec::Cbor ? RecordKind::CborMessage
+                                                   : RecordKind::MessagePackMessage,
+                      message);
+  }
+  dispatchBinaryMessage(message, codec_);
+}
+
+void Webview::dispatchBinaryMessage(const std::string& message, MessageCodec codec) {
+  auto start = timelineNow();
+  MessageEnvelope envelope;
+  auto data = reinterpret_cast<const std::uint8_t*>(message.data());
+  if (!readEnvelope(codec, data, message.size(), envelope)) {
+    return;
+  }
+
+  if (auto binary = binaryCallbacks_.find(envelope.name); binary != binaryCallbacks_.end()) {
+    binary->second(envelope.payload, envelope.size);
+    recordTimeline("message", envelope.name, start);
+    return;
+  }
+
+  auto callback = callbacks_.find(envelope.name);
+  if (callback == callbacks_.end()) {
+    // No callbacks defined
+    return;
+  }
+
+  auto json = decodeMessage(codec, envelope.payload, envelope.size);
+  if (json.is_discarded()) {
+    return;
+  }
+  callback->second(json.dump());
+  recordTimeline("message", envelope.name, start);
+}
+
+void Webview::startRecording(const std::string& path) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    // The marshalled call runs inside a message destructor, where an exception would terminate
+    return Window::pImpl_->postMessageSafe([=] {
+      try {
+        startRecording(path);
+      } catch (const std::exception& exception) {
+        pImpl_->recordingError_ = exception.what();
+      }
+    });
+  }
+
+  recorder_.reset();
+  pImpl_->recordingError_.clear();
+  recorder_ = std::make_unique<Recorder>(path);
+}
+
+void Webview::stopRecording() {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { stopRecording(); });
+  }
+
+  recorder_.reset();
+  pImpl_->recordingError_.clear();
+}
+
+std::string Webview::getRecordingError() {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { return getRecordingError(); });
+  }
+
+  return recorder_ ? recorder_->error() : pImpl_->recordingError_;
+}
+
+ReplayReport Webview::replay(const std::string& path, bool realTime) {
+  using namespace std::chrono;
+
+  ReplayReport report;
+  std::vector<nanoseconds> latencies;
+  auto entries = Recorder::load(path);
+  auto isMessage = [](const RecordEntry& entry) {
+    return entry.kind == RecordKind::Message || entry.kind == RecordKind::MessagePackMessage
+           || entry.kind == RecordKind::CborMessage;
+  };
+  auto first = std::find_if(entries.begin(), entries.end(), isMessage);
+  if (first == entries.end()) {
+    return report;
+  }
+
+  // Latency is measured from the moment a message was due, so falling behind the recorded pace
+  // shows up as latency when replaying in real time.
+  auto origin = first->timestamp;
+  auto start = steady_clock::now();
+  for (auto entry = first; entry != entries.end(); ++entry) {
+    if (!isMessage(*entry)) {
+      continue;
+    }
+
+    auto due = realTime ? start + (entry->timestamp - origin) : steady_clock::now();
+    if (realTime) {
+      std::this_thread::sleep_until(due);
+    }
+    if (entry->kind == RecordKind::MessagePackMessage) {
+      dispatchBinaryMessage(entry->payload, MessageCodec::MessagePack);
+    } else if (entry->kind == RecordKind::CborMessage) {
+      dispatchBinaryMessage(entry->payload, MessageCodec::Cbor);
+    } else {
+      dispatchMessage(entry->payload, true);
+    }
+    latencies.push_back(duration_cast<nanoseconds>(steady_clock::now() - due));
+  }
+
+  report.messages = latencies.size();
+  report.elapsed = duration_cast<nanoseconds>(steady_clock::now() - start);
+  if (report.elapsed.count() > 0) {
+    report.throughput = report.messages / duration<double>(report.elapsed).count();
+  }
+
+  nanoseconds total{0};
+  for (auto latency : latencies) {
+    total += latency;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  report.meanLatency = total / static_cast<long long>(latencies.size());
+  report.p99Latency = latencies[(latencies.size() - 1) * 99 / 100];
+  report.maxLatency = latencies.back();
+  return report;
+}
+
+SharedBuffer::SharedBuffer(std::uint32_t id, std::unique_ptr<Impl> impl)
+    : id_{id}, pImpl_{std::move(impl)} {}
+
+SharedBuffer::~SharedBuffer() {
+  if (!pImpl_->buffer_) {
+    return;
+  }
+  if (std::this_thread::get_id() == pImpl_->threadId_) {
+    pImpl_->buffer_->Close();
+    return;
+  }
+
+  auto buffer = pImpl_->buffer_.detach();
+  auto call = new SafeCallMessage<void>([buffer] {
+    buffer->Close();
+    buffer->Release();
+  });
+  // If the window is already gone the post fails and the buffer is leaked, as there is no thread
+  // left to close it on
+  PostMessage(pImpl_->hwnd_, pImpl_->safeCallMessage_, 0, reinterpret_cast<LPARAM>(call));
+}
+
+std::uint32_t SharedBuffer::id() const { return id_; }
+
+std::uint8_t* SharedBuffer::data() { return pImpl_->data_; }
+
+const std::uint8_t* SharedBuffer::data() const { return pImpl_->data_; }
+
+std::size_t SharedBuffer::size() const { return static_cast<std::size_t>(pImpl_->size_); }
+
+std::shared_ptr<SharedBuffer> Webview::createSharedBuffer(std::size_t size) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    // The marshalled call runs inside a message destructor, where an exception would terminate
+    return Window::pImpl_->postMessageSafe([=]() -> std::shared_ptr<SharedBuffer> {
+      try {
+        return createSharedBuffer(size);
+      } catch (const std::exception&) {
+        return nullptr;
+      }
+    });
+  }
+
+  auto environment = pImpl_->environment_.try_query<ICoreWebView2Environment12>();
+  if (!environment) {
+    throw std::runtime_error("Shared buffers are not supported by this WebView2 runtime");
+  }
+
+  auto impl = std::make_unique<SharedBuffer::Impl>();
+  if (FAILED(environment->CreateSharedBuffer(size, &impl->buffer_))
+      || FAILED(impl->buffer_->get_Buffer(&impl->data_))) {
+    throw std::runtime_error("Cannot create shared buffer");
+  }
+  impl->size_ = size;
+  impl->hwnd_ = Window::pImpl_->hwnd;
+  impl->safeCallMessage_ = Window::pImpl_->WM_POSTMESSAGESAFE;
+  impl->threadId_ = Window::pImpl_->windowThreadId;
+
+  for (auto it = sharedBuffers_.begin(); it != sharedBuffers_.end();) {
+    it = it->second.expired() ? sharedBuffers_.erase(it) : std::next(it);
+  }
+
+  auto buffer = std::shared_ptr<SharedBuffer>(new SharedBuffer(++nextBufferId_, std::move(impl)));
+  sharedBuffers_[buffer->id()] = buffer;
+  postSharedBuffer(*buffer);
+  return buffer;
+}
+
+void Webview::postSharedBuffer(const SharedBuffer& buffer) {
+  if (auto webview17 = pImpl_->webview_.try_query<ICoreWebView2_17>(); webview17) {
+    auto additionalData = R"({"sharedBuffer": )" + std::to_string(buffer.id()) + "}";
+    webview17->PostSharedBufferToScript(buffer.pImpl_->buffer_.get(),
+                                        COREWEBVIEW2_SHARED_BUFFER_ACCESS_READ_WRITE,
+                                        s2ws(additionalData).c_str());
+  }
+}
+
+void Webview::notifyBufferChanged(const SharedBuffer& buffer, std::size_t offset,
+                                  std::size_t length) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    auto id = buffer.id();
+    return Window::pImpl_->postMessageSafe([=] {
+      auto shared = sharedBuffers_.find(id);
+      if (shared != sharedBuffers_.end()) {
+        if (auto locked = shared->second.lock()) {
+          notifyBufferChanged(*locked, offset, length);
+        }
+      }
+    });
+  }
+
+  nlohmann::json json{{"sharedBuffer", buffer.id()}, {"offset", offset}, {"length", length}};
+  pImpl_->webview_->PostWebMessageAsJson(s2ws(json.dump()).c_str());
+}
+
+void Webview::patchHtml(const std::string& html) {
+  {
+    std::lock_guard lock(pImpl_->patchMutex_);
+    pImpl_->pendingHtml_ = html;
+    if (!pImpl_->patchWorker_.joinable()) {
+      pImpl_->patchWorker_ = std::thread([this] { runPatchWorker(); });
+    }
+  }
+  pImpl_->patchCondition_.notify_one();
+}
+
+void Webview::setPatchThreshold(double threshold) {
+  std::lock_guard lock(pImpl_->patchMutex_);
+  pImpl_->patchThreshold_ = threshold;
+}
+
+void Webview::invalidatePatch(bool reload) {
+  {
+    std::lock_guard lock(pImpl_->patchMutex_);
+    pImpl_->patchBaseline_ = false;
+    if (!reload) {
+      // The page no longer shows a patched document, so neither queued nor in-flight work applies
+      pImpl_->patchedHtml_.clear();
+      pImpl_->pendingHtml_.reset();
+      pImpl_->patchLoading_ = false;
+      pImpl_->patchReloadStarting_ = false;
+      pImpl_->patchReloadId_.reset();
+      return;
+    }
+    if (pImpl_->patchedHtml_.empty()) {
+      return;
+    }
+    if (!pImpl_->pendingHtml_) {
+      pImpl_->pendingHtml_ = pImpl_->patchedHtml_;
+    }
+  }
+  pImpl_->patchCondition_.notify_one();
+}
+
+void Webview::runPatchWorker() {
+  HtmlNode previous;
+  while (true) {
+    std::string html;
+    bool baseline;
+    double threshold;
+    {
+      std::unique_lock lock(pImpl_->patchMutex_);
+      pImpl_->patchCondition_.wait(lock, [&] {
+        return pImpl_->patchStopping_ || (pImpl_->pendingHtml_ && !pImpl_->patchLoading_);
+      });
+      if (pImpl_->patchStopping_) {
+        return;
+      }
+      html = std::move(*pImpl_->pendingHtml_);
+      pImpl_->pendingHtml_.reset();
+      baseline = pImpl_->patchBaseline_;
+      threshold = pImpl_->patchThreshold_;
+      pImpl_->patchBaseline_ = true;
+      pImpl_->patchedHtml_ = html;
+    }
+
+    // An exception here would terminate the process, so anything unexpected reloads instead
+    HtmlPatch patch{true};
+    try {
+      auto next = parseHtml(html);
+      if (baseline) {
+        patch = diffHtml(previous, next, html.size(), threshold);
+      }
+      previous = std::move(next);
+    } catch (const std::exception&) {
+      patch = HtmlPatch{true};
+      previous = HtmlNode{};
+    }
+
+    // Posted calls may run after the webview is gone
+    auto alive = pImpl_->alive_;
+    if (patch.reload) {
+      {
+        std::lock_guard lock(pImpl_->patchMutex_);
+        pImpl_->patchLoading_ = true;
+      }
+      Window::pImpl_->postMessageSafe([this, alive, html] {
+        if (!*alive) {
+          return;
+        }
+        {
+          // Dropped when a navigation replaced the document in the meantime
+          std::lock_guard lock(pImpl_->patchMutex_);
+          if (!pImpl_->patchLoading_) {
+            return;
+          }
+        }
+        pImpl_->patchReloadStarting_ = true;
+        // A synchronous failure, such as a document over the 2 MB limit, never starts a
+        // navigation; release the worker and make the next patch reload again
+        if (!loadHtml(html)) {
+          pImpl_->patchReloadStarting_ = false;
+          {
+            std::lock_guard lock(pImpl_->patchMutex_);
+            pImpl_->patchLoading_ = false;
+            pImpl_->patchBaseline_ = false;
+          }
+          pImpl_->patchCondition_.notify_one();
+        }
+      });
+    } else if (!patch.ops.empty()) {
+      // Escaped to ASCII so the narrow-to-wide conversion of executeScript keeps the text intact
+      auto script = "window.webview.applyPatch("
+                    + patch.ops.dump(-1, ' ', true, nlohmann::json::error_handler_t::replace)
+                    + ");";
+      Window::pImpl_->postMessageSafe([this, alive, script] {
+        if (*alive) {
+          executeScript(script);
+        }
+      });
+    }
+  }
+}
+
+void Webview::setIdlePolicy(const IdlePolicy& policy) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { setIdlePolicy(policy); });
+  }
+
+  wake();
+  pImpl_->idlePolicy_ = policy;
+  if (policy.timeout.count() && !pImpl_->idleTimer_) {
+    pImpl_->idleTimer_ = SetTimer(nullptr, 0, 1000, &Impl::onIdleTimer);
+    Impl::idleTimers_[pImpl_->idleTimer_] = this;
+  } else if (!policy.timeout.count() && pImpl_->idleTimer_) {
+    KillTimer(nullptr, pImpl_->idleTimer_);
+    Impl::idleTimers_.erase(pImpl_->idleTimer_);
+    pImpl_->idleTimer_ = 0;
+  }
+}
+
+void Webview::checkIdle() {
+  const auto& policy = pImpl_->idlePolicy_;
+  if (pImpl_->idle_ || !policy.timeout.count()
+      || std::chrono::steady_clock::now() - pImpl_->lastActivity_ < policy.timeout) {
+    return;
+  }
+
+  BOOL visible = FALSE;
+  pImpl_->webviewController_->get_IsVisible(&visible);
+  if (visible && policy.hiddenOnly) {
+    return;
+  }
+
+  pImpl_->idle_ = true;
+  pImpl_->trimView(pImpl_->webview_, !visible);
+  // Parked views are always hidden; they are trimmed along with the active one and restored when
+  // swapped in
+  for (const auto& view : pImpl_->prefetched_) {
+    if (view.webview_ && view.loaded_ == true) {
+      pImpl_->trimView(view.webview_, true);
+    }
+  }
+
+  if (auto webview13 = pImpl_->webview_.try_query<ICoreWebView2_13>();
+      webview13 && policy.clearCache) {
+    wil::com_ptr<ICoreWebView2Profile> profile;
+    webview13->get_Profile(&profile);
+    if (auto profile2 = profile.try_query<ICoreWebView2Profile2>(); profile2) {
+      profile2->ClearBrowsingData(
+          COREWEBVIEW2_BROWSING_DATA_KINDS_DISK_CACHE
+              | COREWEBVIEW2_BROWSING_DATA_KINDS_CACHE_STORAGE,
+          Callback<ICoreWebView2ClearBrowsingDataCompletedHandler>([](HRESULT) { return S_OK; })
+              .Get());
+    }
+  }
+}
+
+void Webview::wake() {
+  pImpl_->lastActivity_ = std::chrono::steady_clock::now();
+  if (!pImpl_->idle_) {
+    return;
+  }
+
+  pImpl_->idle_ = false;
+  Impl::restoreView(pImpl_->webview_);
+  pImpl_->memoryUsage_.suspended = false;
+  pImpl_->memoryUsage_.lowMemoryTarget = false;
+}
+
+void Webview::queryMemoryUsage(MemoryUsageCallback callback) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { queryMemoryUsage(callback); });
+  }
+
+  // Working sets are read from the processes, which does not resume a suspended page; asking the
+  // page itself would, so it reports the last known heap instead
+  pImpl_->updateWorkingSets();
+  if (pImpl_->memoryUsage_.suspended) {
+    return callback(pImpl_->memoryUsage_);
+  }
+
+  auto script = LR"(
+                (() => {
+                    const memory = performance.memory;
+                    return memory ? { used: memory.usedJSHeapSize, total: memory.totalJSHeapSize } : null;
+                })()
+                )";
+  pImpl_->webview_->ExecuteScript(
+      script, Callback<ICoreWebView2ExecuteScriptCompletedHandler>(
+                  [this, callback, alive = pImpl_->alive_](HRESULT result,
+                                                           LPCWSTR resultJson) -> HRESULT {
+                    if (!*alive) {
+                      return S_OK;
+                    }
+                    if (SUCCEEDED(result) && resultJson) {
+                      auto json = nlohmann::json::parse(ws2s(resultJson), nullptr, false);
+                      if (json.is_object()) {
+                        pImpl_->memoryUsage_.jsHeapUsed = json.value("used", std::size_t{0});
+                        pImpl_->memoryUsage_.jsHeapTotal = json.value("total", std::size_t{0});
+                      }
+                    }
+                    callback(pImpl_->memoryUsage_);
+                    return S_OK;
+                  })
+                  .Get());
+}
+
+void Webview::enablePerformanceTimeline(std::size_t capacity) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { enablePerformanceTimeline(capacity); });
+  }
+
+  pImpl_->timeline_.enable(capacity);
+  if (pImpl_->timelineInjected_) {
+    applyState();
+    return;
+  }
+
+  // Entries are batched and flushed over the message channel at most four times per second
+  auto script = R"(
+                (function() {
+                    if (!window.PerformanceObserver) return;
+                    const pending = [];
+                    let timer = null;
+                    const flush = () => {
+                        timer = null;
+                        window.webview.postMessage({ performance: pending.splice(0) });
+                    };
+                    const observer = new PerformanceObserver((list) => {
+                        if (window.webview.performanceTimeline === false) return;
+                        for (const entry of list.getEntries()) {
+                            pending.push({
+                                type: entry.entryType,
+                                name: entry.name,
+                                start: performance.timeOrigin + entry.startTime,
+                                duration: entry.duration,
+                                value: entry.value || 0
+                            });
+                        }
+                        if (!timer) timer = setTimeout(flush, 250);
+                    });
+                    for (const type of ['navigation', 'paint', 'longtask', 'layout-shift', 'largest-contentful-paint']) {
+                        try { observer.observe({ type: type, buffered: true }); } catch (e) {}
+                    }
+                })();
+                )";
+  pImpl_->timelineInjected_ = true;
+  applyScript(script);
+}
+
+void Webview::disablePerformanceTimeline() {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { disablePerformanceTimeline(); });
+  }
+
+  pImpl_->timeline_.disable();
+  if (pImpl_->timelineInjected_) {
+    applyState();
+  }
+}
+
+std::vector<TimelineEntry> Webview::getTimeline(double since) {
+  return pImpl_->timeline_.snapshot(since);
+}
+
+void Webview::clearTimeline() { pImpl_->timeline_.clear(); }
+
+void Webview::recordTimeline(const char* type, const std::string& name, double start) {
+  if (pImpl_->timeline_.enabled()) {
+    pImpl_->timeline_.push(
+        {TimelineSource::Host, type, name, start, timelineNow() - start, 0.0});
+  }
+}
+
+void Webview::prefetch(const std::string& url) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { prefetch(url); });
+  }
+
+  auto& prefetched = pImpl_->prefetched_;
+  if (!pImpl_->prefetchLimit_) {
+    return;
+  }
+  auto existing = std::find_if(prefetched.begin(), prefetched.end(),
+                               [&](const View& view) { return view.url_ == url; });
+  if (existing != prefetched.end() && existing->loaded_ != false) {
+    prefetched.splice(prefetched.begin(), prefetched, existing);
+    return;
+  }
+  // A failed prefetch is retried in a new view
+  if (existing != prefetched.end()) {
+    existing->controller_->Close();
+    pImpl_->stateScripts_.erase(existing->webview_.get());
+    prefetched.erase(existing);
+  }
+
+  auto id = ++pImpl_->nextPrefetchId_;
+  prefetched.push_front(View{nullptr, nullptr, url, id});
+  pImpl_->prefetchStats_.prefetches++;
+  evictPrefetched();
+
+  pImpl_->environment_->CreateCoreWebView2Controller(
+      static_cast<HWND>(getNativeWindow()),
+      Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
+          [this, id, alive = pImpl_->alive_](HRESULT result,
+                                             ICoreWebView2Controller* controller) -> HRESULT {
+            if (!*alive) {
+              if (controller) {
+                controller->Close();
+              }
+              return S_OK;
+            }
+
+            auto& prefetched = pImpl_->prefetched_;
+            auto view = std::find_if(prefetched.begin(), prefetched.end(),
+                                     [&](const View& candidate) { return candidate.id_ == id; });
+            if (FAILED(result) || !controller || view == prefetched.end()) {
+              // Evicted before it was ready
+              if (controller) {
+                controller->Close();
+              }
+              if (view != prefetched.end()) {
+                prefetched.erase(view);
+              }
+              return S_OK;
+            }
+
+            RECT bounds;
+            pImpl_->webviewController_->get_Bounds(&bounds);
+            view->controller_ = controller;
+            view->controller_->put_IsVisible(FALSE);
+            view->controller_->put_Bounds(bounds);
+            view->controller_->get_CoreWebView2(&view->webview_);
+
+            Impl::copySettings(pImpl_->webview_.get(), view->webview_.get());
+            for (const auto& script : pImpl_->injectedScripts_) {
+              view->webview_->AddScriptToExecuteOnDocumentCreated(script.c_str(), nullptr);
+            }
+            if (!pImpl_->stateScript_.empty()) {
+              pImpl_->injectStateScript(view->webview_);
+            }
+            attachHandlers(*view);
+            view->webview_->Navigate(s2ws(view->url_).c_str());
+            return S_OK;
+          })
+          .Get());
+}
+
+void Webview::setPrefetchLimit(std::size_t limit) {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { setPrefetchLimit(limit); });
+  }
+
+  pImpl_->prefetchLimit_ = limit;
+  evictPrefetched();
+}
+
+PrefetchStats Webview::getPrefetchStats() {
+  if (!Window::pImpl_->isThreadSafe()) {
+    return Window::pImpl_->postMessageSafe([=] { return getPrefetchStats(); });
+  }
+
+  return pImpl_->prefetchStats_;
+}
+
+void Webview::evictPrefetched() {
+  auto& prefetched = pImpl_->prefetched_;
+  while (prefetched.size() > pImpl_->prefetchLimit_) {
+    if (prefetched.back().controller_) {
+      prefetched.back().controller_->Close();
+    }
+    pImpl_->stateScripts_.erase(prefetched.back().webview_.get());
+    prefetched.pop_back();
+    pImpl_->prefetchStats_.evictions++;
+  }
+}
+
+bool Webview::swapToPrefetched(const std::string& url) {
+  auto& prefetched = pImpl_->prefetched_;
+  if (!pImpl_->prefetchStats_.prefetches) {
+    return false;
+  }
+
+  auto hit = std::find_if(prefetched.begin(), prefetched.end(), [&](const View& view) {
+    return view.url_ == url && view.controller_;
+  });
+  if (hit == prefetched.end()) {
+    pImpl_->prefetchStats_.misses++;
+    return false;
+  }
+  // A failed prefetch would show its error page; navigating normally retries instead
+  if (hit->loaded_ == false) {
+    hit->controller_->Close();
+    pImpl_->stateScripts_.erase(hit->webview_.get());
+    prefetched.erase(hit);
+    pImpl_->prefetchStats_.evictions++;
+    pImpl_->prefetchStats_.misses++;
+    return false;
+  }
+  pImpl_->prefetchStats_.hits++;
+
+  auto next = std::move(*hit);
+  prefetched.erase(hit);
+
+  RECT bounds;
+  BOOL visible;
+  pImpl_->webviewController_->get_Bounds(&bounds);
+  pImpl_->webviewController_->get_IsVisible(&visible);
+  // Parked views miss setting changes and may have been trimmed by the idle policy
+  Impl::copySettings(pImpl_->webview_.get(), next.webview_.get());
+  Impl::restoreView(next.webview_);
+  next.controller_->put_Bounds(bounds);
+  next.controller_->put_IsVisible(visible);
+  pImpl_->webviewController_->put_IsVisible(FALSE);
+
+  // The previous page stays parked, so navigating back is a swap as well
+  wil::unique_cotaskmem_string source;
+  pImpl_->webview_->get_Source(&source);
+  prefetched.push_front(View{pImpl_->webviewController_, pImpl_->webview_, ws2s(source.get()),
+                             ++pImpl_->nextPrefetchId_, true});
+  pImpl_->webviewController_ = next.controller_;
+  pImpl_->webview_ = next.webview_;
+  evictPrefetched();
+
+  onSourceChanged(url);
+  // Otherwise NavigationCompleted reaches the owner once the page finishes loading
+  if (next.loaded_ == true) {
+    for (const auto& [id, weak] : sharedBuffers_) {
+      if (auto buffer = weak.lock()) {
+        postSharedBuffer(*buffer);
+      }
     }
+    onContentLoaded(true);
   }
+  return true;
 }
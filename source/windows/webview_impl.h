@@ -3,24 +3,245 @@
 
 #include <WebView2.h>
 #include <WebView2EnvironmentOptions.h>
+#include <psapi.h>
 #include <wil/com.h>
 #include <wil/stl.h>
 #include <wil/win32_helpers.h>
 #include <wrl.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
 #include <optional>
+#include <thread>
 
+#include "html_diff.h"
+#include "timeline.h"
+#include "xwebview/shared_buffer.h"
 #include "xwebview/webview.h"
 
 namespace xwebview {
+  struct SharedBuffer::Impl {
+    wil::com_ptr<ICoreWebView2SharedBuffer> buffer_;
+    BYTE* data_ = nullptr;
+    UINT64 size_ = 0;
+    // The buffer may be released from any thread but must be closed on the UI thread
+    HWND hwnd_ = nullptr;
+    UINT safeCallMessage_ = 0;
+    std::thread::id threadId_;
+  };
+
+  struct Webview::View {
+    wil::com_ptr<ICoreWebView2Controller> controller_;
+    wil::com_ptr<ICoreWebView2> webview_;
+    std::string url_;
+    std::uint64_t id_ = 0;
+    std::optional<bool> loaded_;  // Unset while loading, false when the navigation failed
+  };
+
   struct Webview::Impl {
     bool initWebView(HWND hWnd, bool enableRemoteDebugging = false);
+    wil::com_ptr<ICoreWebView2Environment> environment_;
     wil::com_ptr<ICoreWebView2Controller> webviewController_;
     wil::com_ptr<ICoreWebView2> webview_;
-    std::vector<LPCWSTR> injectedScripts_;
+    std::vector<std::wstring> injectedScripts_;
+    static void copySettings(ICoreWebView2* from, ICoreWebView2* to);
+
+    // Hidden views parked for navigate, most recently used first
+    std::list<View> prefetched_;
+    std::size_t prefetchLimit_ = 2;
+    std::uint64_t nextPrefetchId_ = 0;
+    PrefetchStats prefetchStats_;
+
+    // patchHtml worker, only the latest pending document is kept
+    std::thread patchWorker_;
+    std::mutex patchMutex_;
+    std::condition_variable patchCondition_;
+    std::optional<std::string> pendingHtml_;
+    std::string patchedHtml_;
+    bool patchBaseline_ = false;
+    bool patchStopping_ = false;
+    double patchThreshold_ = 0.5;
+    // Set while a reload posted by the worker is loading; patches wait for its document
+    bool patchLoading_ = false;
+    // UI thread only: the navigation of that reload, known once it starts
+    bool patchReloadStarting_ = false;
+    std::optional<UINT64> patchReloadId_;
+
+    // Cleared on destruction; callbacks that can outlive the webview check it first
+    std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
+
+    IdlePolicy idlePolicy_;
+    UINT_PTR idleTimer_ = 0;
+    bool idle_ = false;
+    MemoryUsage memoryUsage_;
+    std::chrono::steady_clock::time_point lastActivity_ = std::chrono::steady_clock::now();
+    static inline std::unordered_map<UINT_PTR, Webview*> idleTimers_;
+    static void CALLBACK onIdleTimer(HWND hWnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime);
+    static std::size_t workingSet(DWORD processId);
+    void updateWorkingSets();
+    void trimView(const wil::com_ptr<ICoreWebView2>& webview, bool hidden);
+    static void restoreView(const wil::com_ptr<ICoreWebView2>& webview);
+
+    TimelineBuffer timeline_;
+    bool timelineInjected_ = false;
+
+    // Bridge state such as the codec lives in one document script per view, replaced on change
+    // so toggling it does not pile up scripts. Ids arrive asynchronously; the generation tells
+    // whether a returned id was superseded meanwhile.
+    struct StateScript {
+      std::wstring id;
+      std::uint64_t generation = 0;
+    };
+    std::wstring stateScript_;
+    std::unordered_map<ICoreWebView2*, StateScript> stateScripts_;
+    void injectStateScript(const wil::com_ptr<ICoreWebView2>& webview);
+
+    // Why the last startRecording marshalled from another thread failed
+    std::string recordingError_;
   };
 
+  inline void Webview::Impl::onIdleTimer(HWND hWnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime) {
+    if (auto webview = idleTimers_.find(idEvent); webview != idleTimers_.end()) {
+      webview->second->checkIdle();
+    }
+  }
+
+  inline std::size_t Webview::Impl::workingSet(DWORD processId) {
+    wil::unique_handle process(
+        OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId));
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (!process || !GetProcessMemoryInfo(process.get(), &counters, sizeof(counters))) {
+      return 0;
+    }
+    return counters.WorkingSetSize;
+  }
+
+  inline void Webview::Impl::updateWorkingSets() {
+    UINT32 browserProcessId = 0;
+    if (SUCCEEDED(webview_->get_BrowserProcessId(&browserProcessId))) {
+      memoryUsage_.browserWorkingSet = workingSet(browserProcessId);
+    }
+
+    // Renderers cannot be told apart per view with this SDK, so the whole environment is counted
+    auto environment8 = environment_.try_query<ICoreWebView2Environment8>();
+    wil::com_ptr<ICoreWebView2ProcessInfoCollection> processes;
+    if (!environment8 || FAILED(environment8->GetProcessInfos(&processes))) {
+      return;
+    }
+    UINT32 count = 0;
+    processes->get_Count(&count);
+    memoryUsage_.rendererWorkingSet = 0;
+    for (UINT32 i = 0; i < count; ++i) {
+      wil::com_ptr<ICoreWebView2ProcessInfo> process;
+      COREWEBVIEW2_PROCESS_KIND kind;
+      INT32 processId;
+      if (SUCCEEDED(processes->GetValueAtIndex(i, &process))
+          && SUCCEEDED(process->get_Kind(&kind)) && kind == COREWEBVIEW2_PROCESS_KIND_RENDERER
+          && SUCCEEDED(process->get_ProcessId(&processId))) {
+        memoryUsage_.rendererWorkingSet += workingSet(static_cast<DWORD>(processId));
+      }
+    }
+  }
+
+  inline void Webview::Impl::trimView(const wil::com_ptr<ICoreWebView2>& webview, bool hidden) {
+    using namespace Microsoft::WRL;
+
+    if (auto webview19 = webview.try_query<ICoreWebView2_19>();
+        webview19 && idlePolicy_.lowMemoryTarget) {
+      webview19->put_MemoryUsageTargetLevel(COREWEBVIEW2_MEMORY_USAGE_TARGET_LEVEL_LOW);
+      if (webview.get() == webview_.get()) {
+        memoryUsage_.lowMemoryTarget = true;
+      }
+    }
+
+    // Suspending requires the view to be hidden
+    auto webview3 = webview.try_query<ICoreWebView2_3>();
+    if (!webview3 || !idlePolicy_.suspend || !hidden) {
+      return;
+    }
+    webview3->TrySuspend(Callback<ICoreWebView2TrySuspendCompletedHandler>(
+                             [this, webview, webview3, alive = alive_](
+                                 HRESULT result, BOOL suspended) -> HRESULT {
+                               // Only the active view reports its state; a parked view swapped in
+                               // meanwhile counts as active
+                               if (!*alive || webview.get() != webview_.get()) {
+                                 return S_OK;
+                               }
+                               // Activity while the suspension was pending wins over it
+                               if (!idle_) {
+                                 if (SUCCEEDED(result) && suspended) {
+                                   webview3->Resume();
+                                 }
+                                 return S_OK;
+                               }
+                               memoryUsage_.suspended = SUCCEEDED(result) && suspended;
+                               return S_OK;
+                             })
+                             .Get());
+  }
+
+  inline void Webview::Impl::injectStateScript(const wil::com_ptr<ICoreWebView2>& webview) {
+    using namespace Microsoft::WRL;
+
+    auto& state = stateScripts_[webview.get()];
+    if (!state.id.empty()) {
+      webview->RemoveScriptToExecuteOnDocumentCreated(state.id.c_str());
+      state.id.clear();
+    }
+    auto generation = ++state.generation;
+    webview->AddScriptToExecuteOnDocumentCreated(
+        stateScript_.c_str(),
+        Callback<ICoreWebView2AddScriptToExecuteOnDocumentCreatedCompletedHandler>(
+            [this, webview, generation, alive = alive_](HRESULT result, LPCWSTR id) -> HRESULT {
+              if (!*alive || FAILED(result)) {
+                return S_OK;
+              }
+              auto state = stateScripts_.find(webview.get());
+              if (state == stateScripts_.end() || state->second.generation != generation) {
+                webview->RemoveScriptToExecuteOnDocumentCreated(id);
+                return S_OK;
+              }
+              state->second.id = id;
+              return S_OK;
+            })
+            .Get());
+  }
+
+  inline void Webview::Impl::restoreView(const wil::com_ptr<ICoreWebView2>& webview) {
+    if (auto webview3 = webview.try_query<ICoreWebView2_3>(); webview3) {
+      BOOL suspended = FALSE;
+      webview3->get_IsSuspended(&suspended);
+      if (suspended) {
+        webview3->Resume();
+      }
+    }
+    if (auto webview19 = webview.try_query<ICoreWebView2_19>(); webview19) {
+      webview19->put_MemoryUsageTargetLevel(COREWEBVIEW2_MEMORY_USAGE_TARGET_LEVEL_NORMAL);
+    }
+  }
+
+  inline void Webview::Impl::copySettings(ICoreWebView2* from, ICoreWebView2* to) {
+    wil::com_ptr<ICoreWebView2Settings> source, target;
+    from->get_Settings(&source);
+    to->get_Settings(&target);
+
+    BOOL state;
+    source->get_AreDevToolsEnabled(&state);
+    target->put_AreDevToolsEnabled(state);
+    source->get_AreDefaultContextMenusEnabled(&state);
+    target->put_AreDefaultContextMenusEnabled(state);
+    source->get_IsZoomControlEnabled(&state);
+    target->put_IsZoomControlEnabled(state);
+    auto source3 = source.try_query<ICoreWebView2Settings3>();
+    auto target3 = target.try_query<ICoreWebView2Settings3>();
+    if (source3 && target3) {
+      source3->get_AreBrowserAcceleratorKeysEnabled(&state);
+      target3->put_AreBrowserAcceleratorKeysEnabled(state);
+    }
+  }
+
   inline bool Webview::Impl::initWebView(HWND hWnd, bool enableRemoteDebugging) {
     using namespace Microsoft::WRL;
 
@@ -41,6 +262,7 @@ namespace xwebview {
         nullptr, temp.c_str(), options.Get(),
         Callback<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>(
             [&](HRESULT result, ICoreWebView2Environment* env) -> HRESULT {
+              environment_ = env;
               env->CreateCoreWebView2Controller(
                   hWnd, Callback<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>(
                             [&](HRESULT result, ICoreWebView2Controller* controller) -> HRESULT {
@@ -0,0 +1,123 @@
+#include <doctest/doctest.h>
+
+#include <string>
+
+#include "html_diff.h"
+
+using namespace xwebview;
+
+namespace {
+  const std::string HEAD = "<html><head><title>Test</title></head>";
+
+  HtmlPatch diff(const std::string& previousBody, const std::string& nextBody,
+                 double threshold = 100) {
+    auto next = HEAD + "<body>" + nextBody + "</body></html>";
+    return diffHtml(parseHtml(HEAD + "<body>" + previousBody + "</body></html>"), parseHtml(next),
+                    next.size(), threshold);
+  }
+}  // namespace
+
+TEST_CASE("Identical documents produce no ops") {
+  auto patch = diff("<div id=\"a\"><p>Hello</p></div>", "<div id=\"a\"><p>Hello</p></div>");
+  CHECK_FALSE(patch.reload);
+  CHECK(patch.ops.empty());
+}
+
+TEST_CASE("Attribute changes") {
+  auto patch = diff("<div class=\"a\" hidden><p title=\"x\">Hi</p></div>",
+                    "<div class=\"b\"><p title=\"x &amp; y\">Hi</p></div>");
+  CHECK_FALSE(patch.reload);
+  REQUIRE(patch.ops.size() == 3);
+
+  CHECK(patch.ops[0]["op"] == "attr");
+  CHECK(patch.ops[0]["path"] == nlohmann::json::array({0}));
+  CHECK(patch.ops[0]["tag"] == "div");
+  CHECK(patch.ops[0]["name"] == "class");
+  CHECK(patch.ops[0]["value"] == "b");
+
+  CHECK(patch.ops[1]["op"] == "removeAttr");
+  CHECK(patch.ops[1]["name"] == "hidden");
+
+  CHECK(patch.ops[2]["op"] == "attr");
+  CHECK(patch.ops[2]["path"] == nlohmann::json::array({0, 0}));
+  CHECK(patch.ops[2]["tag"] == "p");
+  CHECK(patch.ops[2]["value"] == "x & y");
+}
+
+TEST_CASE("Appended and truncated elements") {
+  auto append = diff("<ul><li>1</li></ul>", "<ul><li>1</li><li>2</li><li>3</li></ul>");
+  CHECK_FALSE(append.reload);
+  REQUIRE(append.ops.size() == 1);
+  CHECK(append.ops[0]["op"] == "append");
+  CHECK(append.ops[0]["path"] == nlohmann::json::array({0}));
+  CHECK(append.ops[0]["tag"] == "ul");
+  CHECK(append.ops[0]["html"] == "<li>2</li><li>3</li>");
+
+  auto truncate = diff("<ul><li>1</li><li>2</li><li>3</li></ul>", "<ul><li>1</li></ul>");
+  CHECK_FALSE(truncate.reload);
+  REQUIRE(truncate.ops.size() == 1);
+  CHECK(truncate.ops[0]["op"] == "truncate");
+  CHECK(truncate.ops[0]["count"] == 1);
+}
+
+TEST_CASE("Mixed text and elements") {
+  SUBCASE("Changed text rewrites the element") {
+    auto patch = diff("<p>Hello <b>world</b></p>", "<p>Goodbye <b>world</b></p>");
+    CHECK_FALSE(patch.reload);
+    REQUIRE(patch.ops.size() == 1);
+    CHECK(patch.ops[0]["op"] == "html");
+    CHECK(patch.ops[0]["path"] == nlohmann::json::array({0}));
+    CHECK(patch.ops[0]["html"] == "Goodbye <b>world</b>");
+  }
+
+  SUBCASE("Unchanged text is walked into") {
+    auto patch = diff("<p>Hello <b>world</b></p>", "<p>Hello <b class=\"x\">world</b></p>");
+    CHECK_FALSE(patch.reload);
+    REQUIRE(patch.ops.size() == 1);
+    CHECK(patch.ops[0]["op"] == "attr");
+    CHECK(patch.ops[0]["path"] == nlohmann::json::array({0, 0}));
+  }
+
+  SUBCASE("Changed tag replaces the element") {
+    auto patch = diff("<div><span>a</span></div>", "<div><em>a</em></div>");
+    REQUIRE(patch.ops.size() == 1);
+    CHECK(patch.ops[0]["op"] == "replace");
+    CHECK(patch.ops[0]["tag"] == "span");
+    CHECK(patch.ops[0]["html"] == "<em>a</em>");
+  }
+}
+
+TEST_CASE("Head change forces a reload") {
+  auto previous = parseHtml(HEAD + "<body><p>a</p></body></html>");
+  auto next = parseHtml("<html><head><title>Other</title></head><body><p>a</p></body></html>");
+  CHECK(diffHtml(previous, next, 64, 100).reload);
+
+  auto noBody = parseHtml("<html><head><title>Test</title></head></html>");
+  CHECK(diffHtml(previous, noBody, 64, 100).reload);
+}
+
+TEST_CASE("Patches larger than the threshold fall back to a reload") {
+  std::string items;
+  for (int i = 0; i < 20; ++i) {
+    items += "<li>" + std::to_string(i) + "</li>";
+  }
+  CHECK(diff("<ul></ul>", "<ul>" + items + "</ul>", 0.1).reload);
+  CHECK_FALSE(diff("<ul></ul>", "<ul>" + items + "</ul>", 2).reload);
+}
+
+TEST_CASE("Text that is not valid UTF-8 is replaced") {
+  const std::string replacement = "\xef\xbf\xbd";
+
+  auto latin1 = diff("<p>cafe</p>", "<p>caf\xe9</p>");
+  CHECK_NOTHROW(latin1.ops.dump(-1, ' ', true, nlohmann::json::error_handler_t::replace));
+  REQUIRE(latin1.ops.size() == 1);
+  CHECK(latin1.ops[0]["op"] == "html");
+
+  for (auto entity : {"&#xD800;", "&#9999999;", "&#0;"}) {
+    auto patch = diff("<p title=\"a\">x</p>", std::string("<p title=\"") + entity + "\">x</p>");
+    REQUIRE(patch.ops.size() == 1);
+    CHECK(patch.ops[0]["value"] == replacement);
+    CHECK_NOTHROW(patch.ops.dump());
+  }
+  CHECK(decodeEntities("&#x1F600;") == "\xf0\x9f\x98\x80");
+}
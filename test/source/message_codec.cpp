@@ -0,0 +1,104 @@
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "message_codec.h"
+
+using namespace xwebview;
+
+namespace {
+  // Mirrors Writer.toString() in the bridge script
+  std::wstring toTransport(const std::vector<std::uint8_t>& bytes) {
+    std::wstring text;
+    for (auto byte : bytes) {
+      text.push_back(static_cast<wchar_t>(byte + 0x100));
+    }
+    return text;
+  }
+
+  nlohmann::json roundTrip(MessageCodec codec, const std::vector<std::uint8_t>& bytes,
+                           std::string& name) {
+    std::string message;
+    REQUIRE(readBinaryString(toTransport(bytes), message));
+    REQUIRE(message.size() == bytes.size());
+
+    MessageEnvelope envelope;
+    REQUIRE(readEnvelope(codec, reinterpret_cast<const std::uint8_t*>(message.data()),
+                         message.size(), envelope));
+    name = envelope.name;
+    return decodeMessage(codec, envelope.payload, envelope.size);
+  }
+}  // namespace
+
+TEST_CASE("MessagePack [name, 0]") {
+  std::string name;
+  auto json = roundTrip(MessageCodec::MessagePack, {0x92, 0xa3, 'a', 'd', 'd', 0x00}, name);
+  CHECK(name == "add");
+  CHECK(json == 0);
+}
+
+TEST_CASE("MessagePack [name, Float64Array]") {
+  std::string name;
+  auto json = roundTrip(MessageCodec::MessagePack,
+                        {0x92, 0xa3, 'a', 'd', 'd', 0x92, 0xcb, 0x3f, 0xf8, 0x00, 0x00, 0x00,
+                         0x00, 0x00, 0x00, 0xcb, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+                        name);
+  CHECK(name == "add");
+  CHECK(json == nlohmann::json::array({1.5, 0.0}));
+}
+
+TEST_CASE("CBOR [name, 0]") {
+  std::string name;
+  auto json = roundTrip(MessageCodec::Cbor, {0x82, 0x63, 'a', 'd', 'd', 0x00}, name);
+  CHECK(name == "add");
+  CHECK(json == 0);
+}
+
+TEST_CASE("CBOR [name, Float64Array]") {
+  std::string name;
+  auto json = roundTrip(MessageCodec::Cbor,
+                        {0x82, 0x63, 'a', 'd', 'd', 0x82, 0xfb, 0x3f, 0xf8, 0x00, 0x00, 0x00,
+                         0x00, 0x00, 0x00, 0xfb, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+                        name);
+  CHECK(name == "add");
+  CHECK(json == nlohmann::json::array({1.5, 0.0}));
+}
+
+TEST_CASE("Malformed messages are dropped") {
+  std::string message;
+  CHECK_FALSE(readBinaryString(std::wstring(1, L'\0'), message));
+  CHECK_FALSE(readBinaryString(std::wstring(1, L'A'), message));
+  CHECK_FALSE(readBinaryString(std::wstring(1, static_cast<wchar_t>(0x200)), message));
+
+  const std::uint8_t truncated[] = {0xcb, 0x3f, 0xf8};
+  CHECK(decodeMessage(MessageCodec::MessagePack, truncated, sizeof(truncated)).is_discarded());
+  CHECK(decodeMessage(MessageCodec::Cbor, truncated, sizeof(truncated)).is_discarded());
+
+  MessageEnvelope envelope;
+  const std::uint8_t shortName[] = {0x92, 0xa5, 'a'};
+  CHECK_FALSE(readEnvelope(MessageCodec::MessagePack, shortName, sizeof(shortName), envelope));
+}
+
+TEST_CASE("Binary transport is smaller than JSON for numeric arrays") {
+  auto values = nlohmann::json::array();
+  for (int i = 0; i < 1000; ++i) {
+    values.push_back(i / 7.0);
+  }
+  auto bytes = nlohmann::json::to_msgpack(nlohmann::json::array({"add", values}));
+  auto text = toTransport(bytes);
+
+  // postMessage serializes the string as JSON; no character may need an escape sequence
+  std::string utf8;
+  for (auto c : text) {
+    utf8.push_back(static_cast<char>(0xc0 | (c >> 6)));
+    utf8.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+  }
+  auto serialized = nlohmann::json(utf8).dump();
+  CHECK(serialized.size() == utf8.size() + 2);
+
+  // 9 characters per Float64 against about 18 in JSON
+  auto json = nlohmann::json{{"name", "add"}, {"message", values}}.dump();
+  CHECK(text.size() + 2 < json.size() * 2 / 3);
+}
@@ -0,0 +1,55 @@
+#include <doctest/doctest.h>
+
+#include "timeline.h"
+
+using namespace xwebview;
+
+namespace {
+  void push(TimelineBuffer& buffer, double start) {
+    buffer.push({TimelineSource::Host, "test", "", start, 0, 0});
+  }
+}  // namespace
+
+TEST_CASE("Disabling the timeline keeps the captured entries") {
+  TimelineBuffer buffer;
+  push(buffer, 1);
+  CHECK(buffer.snapshot(0).empty());
+
+  buffer.enable(4);
+  push(buffer, 1);
+  push(buffer, 2);
+  buffer.disable();
+  push(buffer, 3);
+  CHECK(buffer.snapshot(0).size() == 2);
+
+  buffer.enable(4);
+  push(buffer, 4);
+  auto entries = buffer.snapshot(0);
+  REQUIRE(entries.size() == 3);
+  CHECK(entries[2].startTime == 4);
+}
+
+TEST_CASE("Changing the capacity keeps the newest entries") {
+  TimelineBuffer buffer;
+  buffer.enable(3);
+  for (int i = 1; i <= 5; ++i) {
+    push(buffer, i);
+  }
+
+  buffer.enable(2);
+  auto entries = buffer.snapshot(0);
+  REQUIRE(entries.size() == 2);
+  CHECK(entries[0].startTime == 4);
+  CHECK(entries[1].startTime == 5);
+
+  push(buffer, 6);
+  entries = buffer.snapshot(0);
+  REQUIRE(entries.size() == 2);
+  CHECK(entries[0].startTime == 5);
+  CHECK(entries[1].startTime == 6);
+
+  buffer.enable(4);
+  push(buffer, 7);
+  CHECK(buffer.snapshot(0).size() == 3);
+  CHECK(buffer.snapshot(6).size() == 2);
+}